@@ -0,0 +1,487 @@
+#include "../inc/command.h"
+#include "../inc/warm.h"
+#include "../inc/memtable.h"
+#include <fcntl.h>
+#include <time.h>
+
+/*
+ * Microbenchmarks for the storage engine, driven through the same entry points the REPL uses.
+ * Every result is printed as one JSON object per line, so runs can be diffed or fed to a plotter.
+ */
+
+#define BENCH_MAX_ROW_COUNTS 16
+
+typedef struct {
+    uint32_t row_counts[BENCH_MAX_ROW_COUNTS];
+    uint32_t num_row_counts;
+    uint32_t lookups;
+    uint32_t seed;
+    const char *dir;
+    uint32_t open_flags;// DB_OPEN_IO_URING with --io uring, DB_OPEN_HASH with --hash, DB_OPEN_MEMTABLE with --memtable
+    uint32_t threads;   // --threads: writers, and as many readers, for the concurrent run; 0 skips it
+} BenchOptions;
+
+typedef struct {
+    Table *table;
+    const uint32_t *keys;
+    uint32_t count;
+    uint32_t first;// Writers take every threads-th key from here
+    uint32_t step;
+    uint32_t seed;
+    atomic_bool *writers_done;
+    uint64_t operations;
+    uint64_t errors;
+} ConcurrentWorker;
+
+double now_seconds();
+
+void bench_db_path(char *path, size_t size, const BenchOptions *options, const char *name);
+
+uint32_t next_random(uint32_t *state);
+
+void shuffle_keys(uint32_t *keys, uint32_t count, uint32_t seed);
+
+void drop_file_cache(const char *path);
+
+void forget_warm_set(const char *path);
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+void bench_db_path(char *path, size_t size, const BenchOptions *options, const char *name) {
+    snprintf(path, size, "%s/bench_%s.db", options->dir, name);
+}
+
+// xorshift32, so runs with the same seed insert the same key order on every platform
+uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+void shuffle_keys(uint32_t *keys, uint32_t count, uint32_t seed) {
+    uint32_t state = seed == 0 ? 1 : seed;
+    for (uint32_t i = count; i > 1; i--) {
+        const uint32_t j = next_random(&state) % i;
+        const uint32_t key = keys[i - 1];
+        keys[i - 1] = keys[j];
+        keys[j] = key;
+    }
+}
+
+// Evicts the file from the OS page cache, so the next open really reads from disk
+void drop_file_cache(const char *path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Removes the sidecar db_close leaves behind, so the next open starts with an empty pager
+void forget_warm_set(const char *path) {
+    char warm_path[512];
+    snprintf(warm_path, sizeof(warm_path), "%s%s", path, WARM_SET_SUFFIX);
+    unlink(warm_path);
+}
+
+int compare_doubles(const void *a, const void *b) {
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+double percentile(const double *sorted, uint32_t count, double p) {
+    uint32_t index = (uint32_t) (p * (double) count);
+    if (index >= count) {
+        index = count - 1;
+    }
+    return sorted[index];
+}
+
+Table *bench_open(const char *path, const BenchOptions *options) {
+    Table *table = db_open(path, options->open_flags);
+    if (table == NULL) {
+        fprintf(stderr, "bench: unable to open %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+bool bench_insert(const char *name, const char *path, const uint32_t *keys, uint32_t count,
+                  const BenchOptions *options) {
+    unlink(path);
+    Table *table = bench_open(path, options);
+    Statement statement;
+    memset(&statement, 0, sizeof(Statement));
+    statement.type = STATEMENT_INSERT;
+    strcpy(statement.row_to_insert.email, "bench@example.com");
+
+    const double start = now_seconds();
+    for (uint32_t i = 0; i < count; i++) {
+        statement.row_to_insert.id = keys[i];
+        snprintf(statement.row_to_insert.username, sizeof(statement.row_to_insert.username), "user%u",
+                 keys[i]);
+        const ExecuteResult result = execute_insert(&statement, table);
+        if (result != EXECUTE_SUCCESS) {
+            fprintf(stderr, "bench: %s insert of %u failed (%d); raise TABLE_MAX_PAGES\n", name, keys[i],
+                    result);
+            db_close(table);
+            return false;
+        }
+    }
+    if (table->memtable != NULL) {
+        // Rows still buffered are part of the cost
+        pthread_rwlock_wrlock(&table->memtable->latch);
+        const bool merged = memtable_merge(table);
+        pthread_rwlock_unlock(&table->memtable->latch);
+        if (!merged) {
+            fprintf(stderr, "bench: %s memtable merge failed; raise TABLE_MAX_PAGES\n", name);
+            db_close(table);
+            return false;
+        }
+    }
+    const double elapsed = now_seconds() - start;
+
+    TableStats stats;
+    table_stats(table, &stats);
+    printf("{\"bench\":\"%s\",\"rows\":%u,\"seconds\":%.6f,\"rows_per_sec\":%.0f,"
+           "\"height\":%u,\"leaf_pages\":%u,\"internal_pages\":%u,\"leaf_fill\":%.4f,"
+           "\"leaf_splits\":%llu,\"internal_splits\":%llu}\n",
+           name, count, elapsed, count / elapsed, stats.tree_height, stats.leaf_pages, stats.internal_pages,
+           stats.leaf_fill, (unsigned long long) stats.leaf_splits, (unsigned long long) stats.internal_splits);
+    fflush(stdout);
+    return db_close(table);
+}
+
+void bench_find(const char *name, Table *table, uint32_t rows, const BenchOptions *options) {
+    double *latencies = malloc(sizeof(double) * options->lookups);
+    uint32_t state = options->seed == 0 ? 1 : options->seed;
+    uint32_t misses = 0;
+
+    const double start = now_seconds();
+    for (uint32_t i = 0; i < options->lookups; i++) {
+        const uint32_t key = next_random(&state) % rows;
+        const double lookup_start = now_seconds();
+        Cursor cursor;
+        table_find(table, key, &cursor);
+        if (!cursor_holds_key(&cursor, key)) {
+            misses++;
+        }
+        cursor_close(&cursor);
+        latencies[i] = now_seconds() - lookup_start;
+    }
+    const double elapsed = now_seconds() - start;
+
+    qsort(latencies, options->lookups, sizeof(double), compare_doubles);
+    const uint32_t n = options->lookups;
+    printf("{\"bench\":\"%s\",\"rows\":%u,\"lookups\":%u,\"misses\":%u,\"lookups_per_sec\":%.0f,"
+           "\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,\"max_us\":%.3f}\n",
+           name, rows, n, misses, n / elapsed, percentile(latencies, n, 0.50) * 1e6,
+           percentile(latencies, n, 0.90) * 1e6, percentile(latencies, n, 0.99) * 1e6,
+           percentile(latencies, n, 0.999) * 1e6, latencies[n - 1] * 1e6);
+    fflush(stdout);
+    free(latencies);
+}
+
+void bench_scan(const char *name, Table *table, uint32_t rows) {
+    Row row;
+    uint64_t scanned = 0;
+    uint64_t checksum = 0;
+
+    // Read the counter directly: table_stats walks the tree, which would warm the cold run
+    const uint64_t pages_read = atomic_load(&table->pager->stats.pages_read);
+    const double start = now_seconds();
+    Cursor cursor;
+    table_start(table, &cursor);
+    while (!(cursor.end_of_table)) {
+        deserialize_row(cursor_value(&cursor), &row);
+        checksum += row.id;
+        scanned++;
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    const double elapsed = now_seconds() - start;
+
+    printf("{\"bench\":\"%s\",\"rows\":%u,\"scanned\":%llu,\"seconds\":%.6f,\"rows_per_sec\":%.0f,"
+           "\"checksum\":%llu,\"pages_read\":%llu}\n",
+           name, rows, (unsigned long long) scanned, elapsed, scanned / elapsed,
+           (unsigned long long) checksum,
+           (unsigned long long) (atomic_load(&table->pager->stats.pages_read) - pages_read));
+    fflush(stdout);
+}
+
+// Usernames are user{key}, so about one row in nine matches
+void bench_scan_filter(const char *name, Table *table, uint32_t rows) {
+    StringFilter filter = {.offset = USERNAME_OFFSET, .size = USERNAME_SIZE, .kind = MATCH_PREFIX, .length = 5};
+    strcpy(filter.text, "user1");
+    Row row;
+    uint64_t scanned = 0;
+    uint64_t matched = 0;
+
+    const double start = now_seconds();
+    Cursor cursor;
+    table_start(table, &cursor);
+    while (!(cursor.end_of_table)) {
+        const void *value = cursor_value(&cursor);
+        if (string_filter_matches(&filter, value)) {
+            deserialize_row(value, &row);
+            matched++;
+        }
+        scanned++;
+        cursor_advance(&cursor);
+    }
+    cursor_close(&cursor);
+    const double elapsed = now_seconds() - start;
+
+    printf("{\"bench\":\"%s\",\"rows\":%u,\"scanned\":%llu,\"matched\":%llu,\"seconds\":%.6f,"
+           "\"rows_per_sec\":%.0f}\n",
+           name, rows, (unsigned long long) scanned, (unsigned long long) matched, elapsed, scanned / elapsed);
+    fflush(stdout);
+}
+
+void *concurrent_writer(void *arg) {
+    ConcurrentWorker *worker = arg;
+    Statement statement;
+    memset(&statement, 0, sizeof(Statement));
+    statement.type = STATEMENT_INSERT;
+    strcpy(statement.row_to_insert.email, "bench@example.com");
+    for (uint32_t i = worker->first; i < worker->count; i += worker->step) {
+        statement.row_to_insert.id = worker->keys[i];
+        snprintf(statement.row_to_insert.username, sizeof(statement.row_to_insert.username), "user%u",
+                 worker->keys[i]);
+        if (execute_insert(&statement, worker->table) != EXECUTE_SUCCESS) {
+            worker->errors++;
+        }
+        worker->operations++;
+    }
+    return NULL;
+}
+
+// Alternates point lookups, full scans and table_stats until the writers finish, checking what it reads
+void *concurrent_reader(void *arg) {
+    ConcurrentWorker *worker = arg;
+    uint32_t state = worker->seed;
+    uint64_t last_scanned = 0;
+    while (!atomic_load(worker->writers_done)) {
+        for (uint32_t i = 0; i < 100; i++) {
+            const uint32_t key = next_random(&state) % worker->count;
+            Cursor cursor;
+            table_find(worker->table, key, &cursor);
+            if (cursor_holds_key(&cursor, key) && *(uint32_t *) (cursor_value(&cursor) + ID_OFFSET) != key) {
+                worker->errors++;
+            }
+            cursor_close(&cursor);
+            worker->operations++;
+        }
+
+        // Rows are only ever added, and a B+tree scan returns them in key order
+        uint64_t scanned = 0;
+        uint32_t previous = 0;
+        Cursor cursor;
+        table_start(worker->table, &cursor);
+        while (!(cursor.end_of_table)) {
+            const uint32_t key = *(uint32_t *) (cursor_value(&cursor) + ID_OFFSET);
+            if (!worker->table->hash && scanned > 0 && key <= previous) {
+                worker->errors++;
+            }
+            previous = key;
+            scanned++;
+            cursor_advance(&cursor);
+        }
+        cursor_close(&cursor);
+        if (scanned < last_scanned) {
+            worker->errors++;
+        }
+        last_scanned = scanned;
+        worker->operations++;
+
+        // .stats walks the tree alongside the writers too
+        TableStats stats;
+        table_stats(worker->table, &stats);
+        if (stats.rows + stats.memtable_rows < scanned) {
+            worker->errors++;
+        }
+        worker->operations++;
+    }
+    return NULL;
+}
+
+/*
+ * Writers insert disjoint slices of the shuffled keys while readers look up and scan, exercising
+ * the latch protocol; run it under ThreadSanitizer with make tsan.
+ */
+bool bench_concurrent(const char *name, const char *path, const uint32_t *keys, uint32_t count,
+                      const BenchOptions *options) {
+    unlink(path);
+    Table *table = bench_open(path, options);
+    const uint32_t threads = options->threads;
+    atomic_bool writers_done = false;
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads * 2);
+    ConcurrentWorker *workers = calloc(threads * 2, sizeof(ConcurrentWorker));
+
+    const double start = now_seconds();
+    for (uint32_t i = 0; i < threads * 2; i++) {
+        workers[i] = (ConcurrentWorker) {.table = table, .keys = keys, .count = count, .first = i, .step = threads,
+                                         .seed = options->seed + i + 1, .writers_done = &writers_done};
+        pthread_create(&ids[i], NULL, i < threads ? concurrent_writer : concurrent_reader, &workers[i]);
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    const double elapsed = now_seconds() - start;
+    atomic_store(&writers_done, true);
+    uint64_t lookups = 0, errors = 0;
+    for (uint32_t i = threads; i < threads * 2; i++) {
+        pthread_join(ids[i], NULL);
+        lookups += workers[i].operations;
+    }
+    for (uint32_t i = 0; i < threads * 2; i++) {
+        errors += workers[i].errors;
+    }
+
+    // Every row must have made it in exactly once
+    TableStats stats;
+    table_stats(table, &stats);
+    if (stats.rows + stats.memtable_rows != count) {
+        errors++;
+    }
+    printf("{\"bench\":\"%s\",\"rows\":%u,\"threads\":%u,\"seconds\":%.6f,\"rows_per_sec\":%.0f,"
+           "\"reader_operations\":%llu,\"errors\":%llu}\n",
+           name, count, threads, elapsed, count / elapsed, (unsigned long long) lookups,
+           (unsigned long long) errors);
+    fflush(stdout);
+    free(workers);
+    free(ids);
+    return db_close(table) && errors == 0;
+}
+
+bool bench_rows(uint32_t rows, const BenchOptions *options) {
+    uint32_t *keys = malloc(sizeof(uint32_t) * rows);
+    for (uint32_t i = 0; i < rows; i++) {
+        keys[i] = i;
+    }
+    char sequential_path[512], random_path[512];
+    bench_db_path(sequential_path, sizeof(sequential_path), options, "sequential");
+    bench_db_path(random_path, sizeof(random_path), options, "random");
+
+    bool success = bench_insert("insert_sequential", sequential_path, keys, rows, options);
+    shuffle_keys(keys, rows, options->seed);
+    success = success && bench_insert("insert_random", random_path, keys, rows, options);
+    if (success && options->threads > 0) {
+        char concurrent_path[512];
+        bench_db_path(concurrent_path, sizeof(concurrent_path), options, "concurrent");
+        success = bench_concurrent("insert_concurrent", concurrent_path, keys, rows, options);
+        forget_warm_set(concurrent_path);
+        unlink(concurrent_path);
+    }
+    free(keys);
+    if (!success) {
+        return false;
+    }
+
+    // Cold: the pager starts empty and the OS cache is dropped, so every first touch is a read
+    forget_warm_set(random_path);
+    drop_file_cache(random_path);
+    Table *table = bench_open(random_path, options);
+    bench_scan("scan_cold", table, rows);
+    bench_scan("scan_warm", table, rows);
+    bench_scan_filter("scan_filter", table, rows);
+    success = db_close(table);
+
+    forget_warm_set(random_path);
+    drop_file_cache(random_path);
+    table = bench_open(random_path, options);
+    bench_find("find_cold", table, rows, options);
+    bench_find("find_warm", table, rows, options);
+    success = db_close(table) && success;
+
+    // Restart: the OS cache is dropped again, but db_open prefetches the pages find_warm left resident
+    drop_file_cache(random_path);
+    table = bench_open(random_path, options);
+    bench_find("find_restart", table, rows, options);
+    success = db_close(table) && success;
+
+    forget_warm_set(sequential_path);
+    forget_warm_set(random_path);
+    unlink(sequential_path);
+    unlink(random_path);
+    return success;
+}
+
+void usage() {
+    fprintf(stderr, "Usage: simple_db_bench [--rows n[,n...]] [--lookups n] [--seed n] [--dir path] [--io syscall|uring] [--hash] [--memtable n] [--threads n]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = {.row_counts = {10000, 100000},
+                            .num_row_counts = 2,
+                            .lookups = 100000,
+                            .seed = 42,
+                            .dir = "."};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hash") == 0) {
+            options.open_flags |= DB_OPEN_HASH;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+        }
+        if (strcmp(argv[i], "--rows") == 0) {
+            options.num_row_counts = 0;
+            for (char *count = strtok(argv[++i], ","); count != NULL; count = strtok(NULL, ",")) {
+                const double rows = strtod(count, NULL);// accepts 1e6 as well as 1000000
+                if (rows < 1 || rows > UINT32_MAX || options.num_row_counts == BENCH_MAX_ROW_COUNTS) {
+                    usage();
+                }
+                options.row_counts[options.num_row_counts++] = (uint32_t) rows;
+            }
+        } else if (strcmp(argv[i], "--lookups") == 0) {
+            options.lookups = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            options.seed = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--dir") == 0) {
+            options.dir = argv[++i];
+        } else if (strcmp(argv[i], "--io") == 0) {
+            i++;
+            if (strcmp(argv[i], "uring") == 0) {
+                options.open_flags |= DB_OPEN_IO_URING;
+            } else if (strcmp(argv[i], "syscall") != 0) {
+                usage();
+            }
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            options.threads = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--memtable") == 0) {
+            const unsigned long rows = strtoul(argv[++i], NULL, 10);
+            if (rows < 1 || rows > MEMTABLE_MAX_ROWS) {
+                usage();
+            }
+            options.open_flags |= DB_OPEN_MEMTABLE(rows);
+        } else {
+            usage();
+        }
+    }
+    if (options.num_row_counts == 0 || options.lookups == 0) {
+        usage();
+    }
+
+    printf("{\"bench\":\"config\",\"page_size\":%u,\"row_size\":%u,\"leaf_max_cells\":%u,"
+           "\"table_max_pages\":%u,\"seed\":%u,\"io\":\"%s\",\"access\":\"%s\",\"memtable_rows\":%u}\n",
+           PAGE_SIZE, ROW_SIZE, LEAF_NODE_MAX_CELLS, TABLE_MAX_PAGES, options.seed,
+           options.open_flags & DB_OPEN_IO_URING ? "uring" : "syscall",
+           options.open_flags & DB_OPEN_HASH ? "hash" : "btree", DB_OPEN_MEMTABLE_ROWS(options.open_flags));
+    for (uint32_t i = 0; i < options.num_row_counts; i++) {
+        if (!bench_rows(options.row_counts[i], &options)) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
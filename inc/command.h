@@ -9,6 +9,7 @@
 
 #include "../inc/input_buffer.h"
 #include "../inc/store.h"
+#include "../inc/schema.h"
 
 typedef enum {
     META_COMMAND_SUCCESS,
@@ -16,31 +17,109 @@ typedef enum {
 } MetaCommandResult;
 
 typedef enum {
-    STATEMENT_INSERT, STATEMENT_SELECT
+    STATEMENT_INSERT, STATEMENT_SELECT, STATEMENT_CREATE_TABLE
 } StatementType;
 
+typedef enum {
+    COLUMN_ID, COLUMN_USERNAME, COLUMN_EMAIL
+} Column;
+
+#define STATEMENT_MAX_PARAMS 3
+
+typedef enum {
+    MATCH_EXACT, MATCH_PREFIX, MATCH_SUFFIX, MATCH_CONTAINS
+} MatchKind;
+
+/*
+ * where username / email = 'text', or like 'text%', '%text' or '%text%'.
+ * Evaluated on the serialized field, whose string ends at its first NUL; the bytes after it are
+ * unspecified.
+ */
+typedef struct {
+    uint32_t offset;// USERNAME_OFFSET or EMAIL_OFFSET
+    uint32_t size;  // Field bytes, including room for the NUL
+    MatchKind kind;
+    uint32_t length;// Of text, without wildcards
+    char text[COLUMN_EMAIL_SIZE + 1];
+} StringFilter;
+
+/*
+ * where {column} {=|<|>} {value} on a created table. The value is encoded once by the column's
+ * codec, then each row's slot is ordered against it by the codec's compare routine.
+ */
+typedef struct {
+    ColumnCodec codec;
+    int sign;// Of compare(row, value) for a match: 0 for =, -1 for <, 1 for >
+    uint8_t slot[SCHEMA_RECORD_MAX_SIZE];
+} RecordFilter;
+
 typedef struct {
     StatementType type;
     Row row_to_insert;
+    uint32_t num_params;                 // '?' placeholders, numbered from 1 in order of appearance
+    Column params[STATEMENT_MAX_PARAMS]; // Column each placeholder stands for
+    // Inserts into a created table are encoded by prepare; row_to_insert then only holds the id
+    bool has_record;
+    uint8_t record[SCHEMA_RECORD_MAX_SIZE];
+    uint32_t record_params[SCHEMA_MAX_COLUMNS];// Schema column each placeholder stands for
+    Schema schema;                       // create table
+    bool has_where_id;                   // select where id = where_id
+    uint32_t where_id;
+    bool has_filter;                     // select where username / email ...
+    StringFilter filter;
+    bool has_record_filter;              // select where {column} ... on a created table
+    RecordFilter record_filter;
+    bool order_desc;                     // select ... order by id desc
+    uint32_t limit;                      // select ... limit {n}; UINT32_MAX without one
 } Statement;
 
 typedef enum {
     PREPARE_SUCCESS, PREPARE_UNRECOGNIZED_STATEMENT, PREPARE_SYNTAX_ERROR, PREPARE_STRING_TOO_LONG, PREPARE_NEGATIVE_ID,
+    PREPARE_ROW_TOO_WIDE,
 } PrepareResult;
 
 typedef enum {
-    EXECUTE_TABLE_FULL, EXECUTE_SUCCESS, EXECUTE_DUPLICATE_KEY,
+    EXECUTE_TABLE_FULL, EXECUTE_SUCCESS, EXECUTE_DUPLICATE_KEY, EXECUTE_TABLE_EXISTS, EXECUTE_IO_ERROR,
+    EXECUTE_UNORDERED, EXECUTE_SCHEMA,
 } ExecuteResult;
 
 MetaCommandResult do_meta_command(const InputBuffer *input_buffer, Table *table);
 
-PrepareResult prepare_statement(InputBuffer *input_buffer,
-                                Statement *statement);
+/**
+ * @param table inserts and where clauses are parsed against its schema
+ */
+PrepareResult prepare_statement(InputBuffer *input_buffer, const Table *table, Statement *statement);
 
 ExecuteResult execute_insert(const Statement *statement, Table *table);
 
+/**
+ * @brief execute_insert without the memtable: straight into the tree or hash table
+ */
+ExecuteResult tree_execute_insert(const Statement *statement, Table *table);
+
 ExecuteResult execute_select(const Statement *statement, Table *table);
 
+/**
+ * @param value a serialized users row
+ * @return true if the row passes the filter; only matching rows need deserialize_row
+ */
+bool string_filter_matches(const StringFilter *filter, const void *value);
+
+/**
+ * @param value a record of the created table the filter was prepared against
+ */
+bool record_filter_matches(const RecordFilter *filter, const void *value);
+
+/**
+ * @return true if the select's where clause, if any, passes the row or record
+ */
+bool statement_matches(const Statement *statement, const void *value);
+
+/**
+ * @brief gives an empty table without a schema its columns. Must run before other threads use the table.
+ */
+ExecuteResult execute_create_table(const Statement *statement, Table *table);
+
 ExecuteResult execute_statement(Statement *statement, Table *table);
 
 void print_row(Row *row);
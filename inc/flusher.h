@@ -0,0 +1,40 @@
+#ifndef SIMPLE_DATABASE_FLUSHER_H
+#define SIMPLE_DATABASE_FLUSHER_H
+
+#include "../inc/store.h"
+
+/*
+ * Background page flusher.
+ * Every FLUSHER_INTERVAL_MS a per-table thread writes back up to FLUSHER_BATCH_PAGES cold dirty
+ * pages, i.e. pages not written during the previous interval, in file offset order. Pages are
+ * copied out under the latches a writer would take and then written with no latch held, so a
+ * statement waits at most for a memcpy. A batch goes out as one submission. db_close only has to write what is still dirty.
+ */
+
+#ifndef FLUSHER_INTERVAL_MS
+#define FLUSHER_INTERVAL_MS 100
+#endif
+#ifndef FLUSHER_BATCH_PAGES
+#define FLUSHER_BATCH_PAGES 64// Caps write-back at 640 pages (2.5 MB) per second
+#endif
+
+typedef struct Flusher {
+    Table *table;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+    IoBackend *io;// The thread's own, with buffer registered
+    uint32_t page_nums[FLUSHER_BATCH_PAGES];
+    void *buffer;// FLUSHER_BATCH_PAGES page copies, in page_nums order
+} Flusher;
+
+void flusher_start(Table *table);
+
+/**
+ * Waits for the current batch, at most FLUSHER_BATCH_PAGES writes, then joins the thread.
+ * Must not be called while holding the table's tree latch or copy-on-write writer lock.
+ */
+void flusher_stop(Table *table);
+
+#endif //SIMPLE_DATABASE_FLUSHER_H
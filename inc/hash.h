@@ -0,0 +1,78 @@
+#ifndef SIMPLE_DATABASE_HASH_H
+#define SIMPLE_DATABASE_HASH_H
+
+#include "../inc/store.h"
+
+/*
+ * Extendible hash tables, the alternative to the B+tree for exact-id workloads.
+ * Page 0 is a header: a magic, the global depth and the page numbers of the directory pages. The
+ * directory is an array of 2^global_depth bucket page numbers, indexed by the low bits of the key's
+ * hash. A bucket holds up to HASH_BUCKET_MAX_CELLS cells, laid out like leaf cells but unsorted,
+ * plus its local depth. A full bucket splits in two on the next bit of the hash, doubling the
+ * directory first if its local depth has reached the global depth.
+ * A lookup reads the header, one directory page and one bucket, whatever the table size.
+ * Scans visit the buckets in directory order, so rows come back in no particular order.
+ * Inserts that split take the tree latch exclusive, like B+tree splits; everything else holds it
+ * shared plus the bucket's frame latch.
+ */
+
+#define HASH_MAX_GLOBAL_DEPTH 19// 2^19 slots fill 512 directory pages, which the header can list
+
+/*
+ * Bucket Layout
+ */
+extern const uint32_t HASH_BUCKET_LOCAL_DEPTH_OFFSET;
+extern const uint32_t HASH_BUCKET_NUM_CELLS_OFFSET;
+extern const uint32_t HASH_BUCKET_HEADER_SIZE;
+extern const uint32_t HASH_BUCKET_MAX_CELLS;
+
+/**
+ * @brief writes the header, a one-page directory and one empty bucket into a new file
+ */
+void hash_init(Pager *pager);
+
+/**
+ * @brief checks the magic at the start of the file, without going through the page cache
+ */
+bool hash_file_check(const Pager *pager);
+
+uint32_t hash_key(uint32_t key);
+
+uint32_t hash_global_depth(Pager *pager);
+
+/**
+ * @return the page number of the bucket in directory slot index
+ */
+uint32_t hash_bucket_page(Pager *pager, uint32_t index);
+
+uint32_t *hash_bucket_local_depth(void *bucket);
+
+uint32_t *hash_bucket_num_cells(void *bucket);
+
+uint32_t *hash_bucket_key(void *bucket, uint32_t cell_num);
+
+void *hash_bucket_value(void *bucket, uint32_t cell_num);
+
+/**
+ * @brief table_find / table_find_for_insert for hash tables; cell_num is past the last cell if key is absent
+ */
+void hash_find(Table *table, uint32_t key, CursorLatch latch, Cursor *cursor);
+
+void hash_table_start(Table *table, Cursor *cursor);
+
+void hash_cursor_advance(Cursor *cursor);
+
+bool hash_can_insert(const Cursor *cursor, uint32_t key);
+
+/**
+ * @brief appends the cell to the cursor's bucket, splitting it first while it is full
+ */
+void hash_insert(const Cursor *cursor, uint32_t key, const void *value);
+
+/**
+ * @brief fills in the shape fields: buckets count as leaf pages, the header and directory as
+ * internal pages, and the height is the global depth
+ */
+void hash_measure(Table *table, TableStats *stats);
+
+#endif //SIMPLE_DATABASE_HASH_H
@@ -0,0 +1,68 @@
+#ifndef SIMPLE_DATABASE_IO_H
+#define SIMPLE_DATABASE_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Pluggable file I/O for the pager.
+ * A backend runs a batch of positioned, vectored reads or writes and returns once every one of them
+ * has finished. The syscall backend issues one preadv / pwritev per request. The io_uring backend
+ * queues the whole batch and submits it with a single io_uring_enter, so the requests are in flight
+ * together, and reads or writes a registered buffer without mapping its pages on every request.
+ * A backend is not thread-safe: every thread doing I/O on its own opens its own.
+ */
+
+#define IO_RUN_PAGES 64// Most pages one request covers
+
+typedef enum {
+    IO_SYSCALL,
+    IO_URING
+} IoKind;
+
+typedef enum {
+    IO_READ,
+    IO_WRITE
+} IoOp;
+
+typedef struct {
+    struct iovec *iov;
+    uint32_t iovcnt;
+    uint64_t offset;
+    int64_t result;// Bytes transferred, or -errno
+} IoRequest;
+
+typedef struct IoBackend {
+    IoKind kind;
+    int fd;
+    bool (*submit)(struct IoBackend *io, IoOp op, IoRequest *requests, uint32_t count);
+    void (*register_buffer)(struct IoBackend *io, void *buffer, size_t size);// NULL if unsupported
+    void (*close)(struct IoBackend *io);
+} IoBackend;
+
+/**
+ * @param kind IO_URING falls back to IO_SYSCALL if the kernel cannot set up a ring; the backend's kind
+ * tells which one runs
+ */
+IoBackend *io_open(int fd, IoKind kind);
+
+/**
+ * Leaves the file open
+ */
+void io_close(IoBackend *io);
+
+/**
+ * Runs every request; a short transfer is finished with plain syscalls
+ * @return false if any request failed, its result then holds -errno
+ */
+bool io_submit(IoBackend *io, IoOp op, IoRequest *requests, uint32_t count);
+
+/**
+ * Registers buffer with the kernel for the backend's lifetime, if the backend supports it.
+ * Only one buffer can be registered per backend.
+ */
+void io_register_buffer(IoBackend *io, void *buffer, size_t size);
+
+#endif //SIMPLE_DATABASE_IO_H
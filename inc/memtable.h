@@ -0,0 +1,94 @@
+#ifndef SIMPLE_DATABASE_MEMTABLE_H
+#define SIMPLE_DATABASE_MEMTABLE_H
+
+#include "../inc/command.h"
+#include "../inc/store.h"
+
+/*
+ * In-memory write buffer in front of the B+tree.
+ * Inserts go into a skiplist sorted by key, after a duplicate check against both the skiplist and the
+ * tree. When it holds its capacity in rows, the next insert first merges it into the tree in key order:
+ * every run of keys that lands in the same leaf is merged into that leaf with one rewrite, and only a
+ * full leaf goes through the one-key split path. Cursors merge the skiplist with the tree cursor, so
+ * reads see both.
+ * A row is only buffered while the free pages cover a worst-case merge of every buffered row; past
+ * that the buffer is merged early, and once even one row is not covered inserts go straight to the
+ * tree. So a merge never runs out of pages and an acknowledged row is never left behind.
+ * Nodes come from a pool allocated at open, so buffering a row never calls malloc.
+ * The latch is taken before any tree latch: shared by cursors until cursor_close, exclusive by inserts.
+ */
+
+#define MEMTABLE_MAX_ROWS 0xffff// What DB_OPEN_MEMTABLE can encode
+#define MEMTABLE_MAX_LEVEL 12// Expected node count for a full tower: 4^12, far beyond the capacity
+
+typedef struct MemtableNode {
+    uint32_t key;
+    uint32_t level;
+    struct MemtableNode *next[MEMTABLE_MAX_LEVEL];
+    uint8_t value[];// ROW_SIZE bytes
+} MemtableNode;
+
+typedef struct Memtable {
+    pthread_rwlock_t latch;
+    MemtableNode *head;// Sentinel with a full tower and no value
+    uint32_t level;    // Highest level in use
+    uint32_t count;    // Rows in the skiplist
+    uint32_t capacity;
+    uint32_t used;     // Pool nodes handed out since the pool was last empty
+    size_t node_size;
+    char *pool;
+    uint32_t random_state;
+} Memtable;
+
+Memtable *memtable_open(uint32_t capacity);
+
+void memtable_close(Memtable *memtable);
+
+/**
+ * @return the first node with a key >= key, or NULL
+ */
+MemtableNode *memtable_seek(const Memtable *memtable, uint32_t key);
+
+/**
+ * @return the last node with a key < key, or NULL
+ */
+MemtableNode *memtable_seek_before(const Memtable *memtable, uint32_t key);
+
+/**
+ * @brief buffers the row, merging the skiplist into the tree first if it is full or the tree could not
+ * take one more buffered row
+ */
+ExecuteResult memtable_execute_insert(const Statement *statement, Table *table);
+
+/**
+ * @brief moves every buffered row into the tree. The caller holds the memtable latch exclusive, or
+ * is db_close. Rows that do not fit stay buffered.
+ * @return false if the tree ran out of pages, which the reservation in memtable_execute_insert rules out
+ */
+bool memtable_merge(Table *table);
+
+/**
+ * @brief table_start / table_find for tables with a memtable: a cursor that merges the skiplist
+ * with the tree's cursor, kept in the same Cursor, and holds the memtable latch shared until cursor_close
+ */
+void memtable_table_start(Table *table, Cursor *cursor);
+
+void memtable_table_find(Table *table, uint32_t key, Cursor *cursor);
+
+void memtable_table_end(Table *table, Cursor *cursor);
+
+/**
+ * @return true if the merged cursor's current row comes from the skiplist
+ */
+bool memtable_cursor_on_memtable(const Cursor *cursor);
+
+void memtable_cursor_advance(Cursor *cursor);
+
+/**
+ * @brief steps back with one skiplist search per buffered row, since the nodes only link forward
+ */
+void memtable_cursor_retreat(Cursor *cursor);
+
+void memtable_cursor_close(Cursor *cursor);
+
+#endif //SIMPLE_DATABASE_MEMTABLE_H
@@ -0,0 +1,73 @@
+#ifndef SIMPLE_DATABASE_PROFILE_H
+#define SIMPLE_DATABASE_PROFILE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Statement latency profiler.
+ * Instrumentation points take a profile_start() timestamp and hand it to profile_record(). While
+ * profiling is off profile_start() returns 0 and profile_record() ignores it, so an idle point costs
+ * one relaxed load. Latencies land in log-bucketed (HdrHistogram-style) histograms: 16 linear
+ * sub-buckets per power of two of nanoseconds, so any percentile is within 1/16 of the true value.
+ */
+
+#define PROFILE_SUB_BUCKET_BITS 4
+#define PROFILE_SUB_BUCKETS (1 << PROFILE_SUB_BUCKET_BITS)
+#define PROFILE_BUCKETS ((64 - PROFILE_SUB_BUCKET_BITS + 1) * PROFILE_SUB_BUCKETS)
+
+typedef enum {
+    PROFILE_INSERT,   // execute_insert, whole statement
+    PROFILE_SELECT,   // execute_select, whole statement
+    PROFILE_PREPARE,  // prepare_statement
+    PROFILE_FIND,     // table_find / table_find_for_insert descent, latch waits included
+    PROFILE_PAGE_IO,  // get_page reading a missing page from the file
+    PROFILE_SPLIT,    // leaf_node_split_and_insert, with any internal splits it causes
+    PROFILE_PRINT_ROW,// print_row, once per row
+    PROFILE_POINT_COUNT
+} ProfilePoint;
+
+typedef struct {
+    _Atomic uint64_t counts[PROFILE_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+} ProfileHistogram;
+
+typedef struct {
+    uint64_t count;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+} ProfileSummary;
+
+extern const char *const PROFILE_POINT_NAMES[PROFILE_POINT_COUNT];
+
+/**
+ * Turns the histograms on or off; turning them on clears the previous samples
+ */
+void profile_enable(bool enabled);
+
+bool profile_enabled(void);
+
+void profile_set_timer(bool enabled);
+
+bool profile_timer(void);
+
+/**
+ * @return the monotonic clock in nanoseconds, or 0 while profiling is off
+ */
+uint64_t profile_start(void);
+
+void profile_record(ProfilePoint point, uint64_t start);
+
+void profile_summary(ProfilePoint point, ProfileSummary *summary);
+
+uint64_t profile_clock_ns(clockid_t clock);
+
+#endif //SIMPLE_DATABASE_PROFILE_H
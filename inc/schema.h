@@ -0,0 +1,148 @@
+#ifndef SIMPLE_DATABASE_SCHEMA_H
+#define SIMPLE_DATABASE_SCHEMA_H
+
+#include "../inc/store.h"
+
+/*
+ * Table schemas.
+ * A table created with `create table` keeps its column definitions in a one-page catalog file,
+ * {filename}.catalog. When the schema is loaded it is compiled into a codec: every column gets its
+ * offset in the record and the encode / format routines for its type, picked once, so encoding or
+ * printing a row is a straight run of calls with no per-field type dispatch.
+ * Records are laid out back to back in column order and must fit in the ROW_SIZE bytes of a leaf
+ * cell. The first column is the key and must be int32.
+ * Tables without a catalog hold the built-in users rows, which keep the hard-coded Row path.
+ */
+
+#define SCHEMA_MAX_COLUMNS 16
+#define SCHEMA_NAME_SIZE 32  // Including the terminating NUL
+// ROW_SIZE, the value bytes of a leaf cell
+#define SCHEMA_RECORD_MAX_SIZE (sizeof(uint32_t) + COLUMN_USERNAME_SIZE + 1 + COLUMN_EMAIL_SIZE + 1)
+#define SCHEMA_LINE_SIZE 1024// Longest formatted row, plus the NUL
+
+#define CATALOG_SUFFIX ".catalog"
+
+typedef enum {
+    COLUMN_TYPE_INT32,
+    COLUMN_TYPE_INT64,
+    COLUMN_TYPE_DOUBLE,
+    COLUMN_TYPE_CHAR,   // length bytes, NUL padded, plus a NUL, as in the users table
+    COLUMN_TYPE_VARCHAR,// uint16_t byte count, then up to length bytes
+} ColumnType;
+
+typedef enum {
+    CODEC_OK,
+    CODEC_INVALID,
+    CODEC_TOO_LONG,
+} CodecResult;
+
+typedef struct {
+    char name[SCHEMA_NAME_SIZE];
+    ColumnType type;
+    uint32_t length;// char / varchar capacity in bytes, 0 for numbers
+} ColumnDef;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;  // Bytes the slot takes in the record
+    uint32_t length;
+    // The slot must be zeroed first
+    CodecResult (*encode)(const char *text, void *slot, uint32_t length);
+    // Typed values bound through the library; CODEC_INVALID if the column holds another type
+    CodecResult (*encode_int)(int64_t value, void *slot, uint32_t length);
+    CodecResult (*encode_double)(double value, void *slot, uint32_t length);
+    // Appends the value to out, returns the number of characters written
+    size_t (*format)(const void *slot, uint32_t length, char *out);
+    // Orders two slots of the column: negative, zero or positive
+    int (*compare)(const void *a, const void *b, uint32_t length);
+} ColumnCodec;
+
+typedef struct {
+    char table_name[SCHEMA_NAME_SIZE];
+    uint32_t num_columns;
+    ColumnDef columns[SCHEMA_MAX_COLUMNS];
+    ColumnCodec codecs[SCHEMA_MAX_COLUMNS];// Filled in by schema_compile
+    uint32_t record_size;
+} Schema;
+
+typedef struct Catalog {
+    char *path;
+    Schema *schema;// NULL for the built-in users table
+} Catalog;
+
+/**
+ * @brief fills in the codecs and record size
+ * @return false if the columns do not fit in SCHEMA_RECORD_MAX_SIZE bytes or the key is not int32
+ */
+bool schema_compile(Schema *schema);
+
+/**
+ * @brief fills in the built-in users table's schema, whose records have the serialize_row layout
+ */
+void schema_users(Schema *schema);
+
+/**
+ * @return the index of the column called name, or num_columns if there is none
+ */
+uint32_t schema_find_column(const Schema *schema, const char *name);
+
+/**
+ * @param text the values in column order, one per column; NULL leaves the column zeroed, for a
+ * parameter bound later
+ * @param record SCHEMA_RECORD_MAX_SIZE bytes
+ * @param key receives the first column
+ */
+CodecResult schema_encode(const Schema *schema, char *const *text, void *record, uint32_t *key);
+
+/**
+ * Bind one column of an encoded record, replacing what the slot held
+ */
+CodecResult schema_bind_text(const Schema *schema, uint32_t column, const char *text, void *record);
+
+CodecResult schema_bind_int(const Schema *schema, uint32_t column, int64_t value, void *record);
+
+CodecResult schema_bind_double(const Schema *schema, uint32_t column, double value, void *record);
+
+/**
+ * @return the first column, which is the key
+ */
+int32_t schema_record_key(const void *record);
+
+/**
+ * Column accessors: CODEC_INVALID if the column holds another type
+ */
+CodecResult schema_column_int(const Schema *schema, const void *record, uint32_t column, int64_t *value);
+
+CodecResult schema_column_double(const Schema *schema, const void *record, uint32_t column, double *value);
+
+/**
+ * @brief formats any column as text
+ * @param out SCHEMA_LINE_SIZE bytes, NUL terminated
+ */
+void schema_column_text(const Schema *schema, const void *record, uint32_t column, char *out);
+
+/**
+ * @brief formats the record as its values separated by spaces
+ * @param line SCHEMA_LINE_SIZE bytes
+ */
+void schema_format(const Schema *schema, const void *record, char *line);
+
+/**
+ * @brief formats the schema as the create table statement that defines it
+ * @param line SCHEMA_LINE_SIZE bytes
+ */
+void schema_describe(const Schema *schema, char *line);
+
+/**
+ * @brief loads {filename}.catalog, if there is one
+ */
+Catalog *catalog_open(const char *filename);
+
+/**
+ * @brief writes schema, already compiled, to the catalog file and makes it the table's schema
+ */
+bool catalog_create(Catalog *catalog, const Schema *schema);
+
+void catalog_close(Catalog *catalog);
+
+#endif //SIMPLE_DATABASE_SCHEMA_H
@@ -0,0 +1,61 @@
+#ifndef SIMPLE_DATABASE_SHARD_H
+#define SIMPLE_DATABASE_SHARD_H
+
+#include "../inc/command.h"
+#include "../inc/store.h"
+
+/*
+ * Hash-partitioned tables.
+ * A sharded table is a small manifest file plus one B+tree file per shard ({filename}.0, {filename}.1, ...),
+ * each with its own Pager. Rows are routed by a hash of their id. An insert runs on the caller's
+ * thread against the owning shard's Table, whose latches already let threads insert concurrently, so
+ * writers to different shards never share a latch or a file.
+ * Cursors over a sharded table merge the shards' cursors in key order. The per-shard cursors come
+ * from a pool sized at open, so a scan allocates nothing.
+ */
+
+#define SHARD_MAX 255
+#define SHARD_MAX_CURSORS 64
+
+typedef struct ShardSet {
+    uint32_t num_shards;
+    Table **tables;
+    Cursor *cursors;                              // num_shards cursors per slot
+    _Atomic bool cursor_slots[SHARD_MAX_CURSORS]; // true while a merged cursor holds the slot
+} ShardSet;
+
+/**
+ * @return the number of shards recorded in filename, or 0 if it is not a shard manifest
+ */
+uint32_t shard_manifest_count(const char *filename);
+
+/**
+ * @brief opens or creates a sharded table. An existing manifest wins over the requested count,
+ * but asking for a different count fails, since rows would be routed to the wrong shards.
+ * @return NULL on failure
+ */
+Table *shard_open(const char *filename, uint32_t flags);
+
+bool shard_close(Table *table);
+
+uint32_t shard_for_key(const ShardSet *shards, uint32_t key);
+
+/**
+ * @brief inserts the row into the shard that owns its id
+ */
+ExecuteResult shard_execute_insert(const Statement *statement, Table *table);
+
+void shard_table_start(Table *table, Cursor *cursor);
+
+/**
+ * @brief merges the shards' table_end cursors, largest key first
+ */
+void shard_table_end(Table *table, Cursor *cursor);
+
+void shard_cursor_advance(Cursor *cursor);
+
+void shard_cursor_retreat(Cursor *cursor);
+
+void shard_cursor_close(Cursor *cursor);
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef SIMPLE_DATABASE_SIMPLE_DB_H
+#define SIMPLE_DATABASE_SIMPLE_DB_H
+
+#include <stdint.h>
+
+#include "../inc/store.h"
+
+/*
+ * In-process API for embedding the database, in the style of open / prepare / bind / step / finalize / close.
+ * Nothing here writes to stdout or exits the process; every failure is reported as a SimpleDbResult.
+ */
+
+typedef enum {
+    SIMPLE_DB_OK,
+    SIMPLE_DB_ROW,             // simple_db_step produced a row
+    SIMPLE_DB_DONE,            // simple_db_step finished the statement
+    SIMPLE_DB_CANT_OPEN,
+    SIMPLE_DB_IO_ERROR,
+    SIMPLE_DB_SYNTAX_ERROR,
+    SIMPLE_DB_UNRECOGNIZED_STATEMENT,
+    SIMPLE_DB_STRING_TOO_LONG,
+    SIMPLE_DB_NEGATIVE_ID,
+    SIMPLE_DB_DUPLICATE_KEY,
+    SIMPLE_DB_TABLE_FULL,
+    SIMPLE_DB_RANGE,           // Parameter or column index out of range, the wrong type, or a bad fill factor
+    SIMPLE_DB_UNBOUND,         // Stepped before every parameter was bound
+    SIMPLE_DB_ROW_TOO_WIDE,    // create table columns do not fit in a row
+    SIMPLE_DB_TABLE_EXISTS,    // create table on a table that has a schema or rows
+    SIMPLE_DB_SCHEMA,          // where username / email on a created table
+    SIMPLE_DB_UNORDERED,       // order by id desc on a hash table
+    SIMPLE_DB_BUSY,            // vacuum while a snapshot is open
+} SimpleDbResult;
+
+typedef struct SimpleDb SimpleDb;
+
+typedef struct SimpleDbStmt SimpleDbStmt;
+
+/**
+ * @param flags DB_OPEN_* flags
+ * @param db receives the handle, or NULL on failure
+ */
+SimpleDbResult simple_db_open(const char *filename, uint32_t flags, SimpleDb **db);
+
+/**
+ * @brief closes the database, writing every page back. All statements must be finalized first.
+ * @return SIMPLE_DB_IO_ERROR if a page could not be written, or if a read or write failed earlier
+ */
+SimpleDbResult simple_db_close(SimpleDb *db);
+
+/**
+ * @brief rebuilds the file with its leaves in key order, see vacuum.h
+ * @param fill_percent how full to pack each leaf, 1 to 100
+ */
+SimpleDbResult simple_db_vacuum(SimpleDb *db, uint32_t fill_percent);
+
+/**
+ * @param sql the same statements the REPL accepts; in inserts, any value may be a '?' parameter
+ */
+SimpleDbResult simple_db_prepare(SimpleDb *db, const char *sql, SimpleDbStmt **stmt);
+
+/**
+ * Parameters of a created table are encoded by their column's codec: integers bind to int32, int64 and
+ * double columns, doubles only to double columns, and text to any column, parsed as in the REPL.
+ * Anything else is SIMPLE_DB_RANGE.
+ *
+ * @param index parameter number, starting from 1
+ */
+SimpleDbResult simple_db_bind_int(SimpleDbStmt *stmt, uint32_t index, int64_t value);
+
+SimpleDbResult simple_db_bind_text(SimpleDbStmt *stmt, uint32_t index, const char *value);
+
+SimpleDbResult simple_db_bind_double(SimpleDbStmt *stmt, uint32_t index, double value);
+
+/**
+ * @brief runs an insert to completion, or produces the next row of a select
+ *
+ * A select holds its cursor, and with it the latches of the leaf it is on, between steps until it
+ * returns SIMPLE_DB_DONE or is reset. Don't insert from the same thread meanwhile unless the
+ * database was opened with DB_OPEN_COW.
+ *
+ * @param row for SIMPLE_DB_ROW from the users table, points at the row; valid until the next call on the
+ * statement. NULL for a created table, whose values are read with the column accessors.
+ */
+SimpleDbResult simple_db_step(SimpleDbStmt *stmt, const Row **row);
+
+/**
+ * Column accessors for the row the last step produced, in any table; columns are numbered from 0 in
+ * schema order, and users rows have id, username and email.
+ *
+ * @return 0 unless the statement is on a row
+ */
+uint32_t simple_db_column_count(const SimpleDbStmt *stmt);
+
+/**
+ * @return SIMPLE_DB_RANGE unless the column is int32 or int64
+ */
+SimpleDbResult simple_db_column_int(const SimpleDbStmt *stmt, uint32_t column, int64_t *value);
+
+/**
+ * @return SIMPLE_DB_RANGE unless the column is double
+ */
+SimpleDbResult simple_db_column_double(const SimpleDbStmt *stmt, uint32_t column, double *value);
+
+/**
+ * @brief any column, formatted as the REPL prints it
+ * @param value valid until the next call on the statement
+ */
+SimpleDbResult simple_db_column_text(SimpleDbStmt *stmt, uint32_t column, const char **value);
+
+/**
+ * @brief rewinds the statement so it can be stepped again; bound parameters are kept
+ */
+SimpleDbResult simple_db_reset(SimpleDbStmt *stmt);
+
+SimpleDbResult simple_db_finalize(SimpleDbStmt *stmt);
+
+const char *simple_db_result_message(SimpleDbResult result);
+
+#endif
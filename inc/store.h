@@ -3,14 +3,22 @@
 
 #include <assert.h>
 #include <printf.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/errno.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "../inc/io.h"
+
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
 
@@ -18,6 +26,17 @@
 
 #define INVALIDE_PAGE_NUM UINT32_MAX
 
+/*
+ * db_open flags
+ */
+#define DB_OPEN_COW 0x1// copy-on-write commits, lock-free snapshot readers
+#define DB_OPEN_IO_URING 0x2// page reads and writes through io_uring, if the kernel allows it
+#define DB_OPEN_HASH 0x4// new files are extendible hash tables instead of B+trees
+#define DB_OPEN_SHARDS(n) ((uint32_t) (n) << 8)// hash-partition rows across n shard files
+#define DB_OPEN_SHARD_COUNT(flags) ((flags) >> 8 & 0xff)
+#define DB_OPEN_MEMTABLE(rows) ((uint32_t) (rows) << 16)// buffer up to rows inserts in memory, see memtable.h
+#define DB_OPEN_MEMTABLE_ROWS(flags) ((flags) >> 16 & 0xffff)
+
 typedef struct {
     uint32_t id;
     char username[COLUMN_USERNAME_SIZE + 1];
@@ -39,7 +58,10 @@ extern const uint32_t ROW_SIZE;
  * Page and Table Layout
  */
 extern const uint32_t PAGE_SIZE;
+#ifndef TABLE_MAX_PAGES
 #define TABLE_MAX_PAGES 100
+#endif
+#define BTREE_MAX_HEIGHT 32
 
 /*
  * Common Node Header Layout
@@ -59,7 +81,12 @@ extern const uint32_t LEAF_NODE_NUM_CELLS_SIZE;
 extern const uint32_t LEAF_NODE_NUM_CELLS_OFFSET;
 extern const uint32_t LEAF_NODE_NEXT_LEAF_SIZE;
 extern const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET;
+extern const uint32_t LEAF_NODE_PREV_LEAF_SIZE;
+extern const uint32_t LEAF_NODE_PREV_LEAF_OFFSET;
 extern const uint32_t LEAF_NODE_HEADER_SIZE;
+// Files from before leaves had a prev link: the same header without it, and no format marker
+extern const uint32_t LEGACY_LEAF_NODE_HEADER_SIZE;
+extern const uint32_t BTREE_FORMAT_MAGIC;
 
 /*
  * Leaf Node Body Layout
@@ -95,38 +122,221 @@ typedef enum {
     NODE_INTERNAL
 } NodeType;
 
+/*
+ * Always-on engine counters. Bumped with relaxed atomics, so reading them never blocks a cursor.
+ */
+typedef struct {
+    _Atomic uint64_t cache_hits;   // get_page found the frame resident
+    _Atomic uint64_t cache_misses; // get_page had to allocate a frame
+    _Atomic uint64_t pages_read;   // Misses served from the file, plus pages prefetched by db_open
+    _Atomic uint64_t bytes_read;
+    _Atomic uint64_t pages_written;
+    _Atomic uint64_t bytes_written;
+    _Atomic uint64_t leaf_splits;
+    _Atomic uint64_t internal_splits;
+} PagerStats;
+
 typedef struct {
     int file_descriptor;
-    uint32_t file_length;
+    IoBackend *io;// Used under lock, or by db_open / db_close while no other thread runs
+    char *filename;
+    uint64_t file_length;// Bytes in the file at open; offsets are 64-bit, page numbers stay 32-bit on disk
     uint32_t num_pages;
+    PagerStats stats;
+    _Atomic uint32_t flush_epoch;              // Advanced by the flusher on every pass
+    _Atomic uint32_t dirty[TABLE_MAX_PAGES];   // flush_epoch of the last write to each frame, 0 if clean
     void *pages[TABLE_MAX_PAGES];
+    uint32_t touched[TABLE_MAX_PAGES];        // flush_epoch of the last get_page on each frame, 0 if none
+    pthread_mutex_t lock;                     // Guards pages[], touched[], num_pages and file I/O
+    pthread_rwlock_t latches[TABLE_MAX_PAGES];// Per-frame reader/writer latches on the page contents
+    _Atomic int error;                        // First errno the pager hit, 0 while healthy; see pager_fail
+    void *scratch;                            // Empty leaf handed out for a page that could not be loaded
 } Pager;
 
+/*
+ * Copy-on-write (shadow paging) state.
+ * A writer copies the root-to-leaf path it modifies onto fresh pages and then publishes the new
+ * root. Readers pin the published version and never take a latch. A superseded page is recycled
+ * once every pinned version is at least as new as the commit that superseded it.
+ */
+#define COW_MAX_READERS 64
+
 typedef struct {
-    uint32_t root_page_num;
+    pthread_mutex_t writer_lock;               // One writer at a time
+    _Atomic uint64_t version;                  // Published version: txn << 32 | root page
+    _Atomic uint32_t readers[COW_MAX_READERS]; // txn pinned by each reader slot, 0 if free
+    _Atomic bool vacuuming;                    // table_vacuum is swapping the file, cow_pin waits
+    uint32_t txn;                              // txn being built by the writer
+    uint32_t fresh_txn[TABLE_MAX_PAGES];       // txn that last wrote each page
+    uint32_t num_retired;
+    uint32_t retired_pages[TABLE_MAX_PAGES];   // Superseded pages still visible to older versions
+    uint32_t retired_txns[TABLE_MAX_PAGES];    // txn that superseded each retired page
+    uint32_t num_free;
+    uint32_t free_pages[TABLE_MAX_PAGES];      // Pages no version can reach any more
+} CowState;
+
+typedef struct {
+    uint32_t root_page_num;// In copy-on-write mode, the writer's working root
     Pager *pager;
+    CowState *cow;         // NULL unless opened with DB_OPEN_COW
+    struct ShardSet *shards;// NULL unless the rows live in shard files; the table then has no pager
+    struct Flusher *flusher;// Background write-back thread, NULL for sharded tables
+    struct Catalog *catalog;// Column definitions, from {filename}.catalog
+    bool hash;              // Extendible hash file, see hash.h; root_page_num is unused
+    struct Memtable *memtable;// Insert buffer, NULL unless opened with DB_OPEN_MEMTABLE
+    /*
+     * Held shared by every cursor. Held exclusive by writers whose insert has to split,
+     * which then run without frame latches.
+     */
+    pthread_rwlock_t tree_latch;
 } Table;
 
-typedef struct {
+/*
+ * Latches a cursor holds from table_find until cursor_close
+ */
+typedef enum {
+    CURSOR_LATCH_SHARED,   // tree latch shared, leaf frame latch shared
+    CURSOR_LATCH_EXCLUSIVE,// tree latch shared, leaf frame latch exclusive
+    CURSOR_LATCH_TREE,     // tree latch exclusive, no frame latches
+    CURSOR_LATCH_SNAPSHOT, // copy-on-write reader: pins a version, no latches
+    CURSOR_LATCH_COW_WRITER// copy-on-write writer: holds the writer lock, commits on close
+} CursorLatch;
+
+typedef struct Cursor {
     Table *table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;// Indicates a position one past the last element
+    CursorLatch latch;
+    uint32_t root_page_num;// Root the cursor descended from
+    uint32_t reader_slot;  // CURSOR_LATCH_SNAPSHOT only
+    uint32_t directory_index;// Hash tables only: directory slot of the bucket
+    struct Cursor *shard_cursors; // Sharded tables only: one cursor per shard, merged in key order
+    uint32_t current_shard;       // Shard whose cursor holds the smallest key
+    bool merges_memtable;               // Tables with a memtable only: the fields above are the tree's position,
+    bool tree_end_of_table;             // ... the tree's own end_of_table,
+    struct MemtableNode *memtable_node; // ... and the next buffered row, merged in key order
+    bool descending;                    // Merged cursors from table_end: the largest key comes first
 } Cursor;
 
+/*
+ * Point-in-time copy of the counters plus the shape of the tree, summed over shards
+ */
+typedef struct {
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t pages_read;
+    uint64_t bytes_read;
+    uint64_t pages_written;
+    uint64_t bytes_written;
+    uint64_t leaf_splits;
+    uint64_t internal_splits;
+    uint32_t tree_height;   // Levels, a lone root leaf is 1; the global depth for hash tables
+    uint32_t num_pages;     // Pages in the file, including ones no longer in the tree
+    uint32_t leaf_pages;
+    uint32_t internal_pages;
+    uint64_t rows;
+    double leaf_fill;       // rows / (leaf_pages * cells per leaf or bucket)
+    uint64_t memtable_rows; // Rows still buffered, not counted in rows
+} TableStats;
+
+
+Pager *pager_open(const char *filename, IoKind io_kind);
+
+/**
+ * Frees every frame and closes the file
+ * @param flush write every resident page back first
+ */
+bool pager_close(Pager *pager, bool flush);
+
+/**
+ * Writes every dirty resident page in one batch, consecutive pages coalesced into one request
+ */
+bool pager_flush_dirty(Pager *pager);
+
+/**
+ * Every write to a frame must be followed by this, or db_close will not write the page back
+ */
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
 
-Pager *pager_open(const char *filename);
+/**
+ * Records a read or write that failed, or a page number the file cannot hold. Only the first error
+ * is kept. Statements on a failed table return EXECUTE_IO_ERROR, and db_close returns false.
+ */
+void pager_fail(Pager *pager, int error);
 
-Table *db_open(const char *filename);
+/**
+ * @return the first error recorded by the table's pager, or by any of its shards' pagers; 0 if none
+ */
+int table_io_error(const Table *table);
 
 /**
- *
- * @param table Table*
- * @return a Cursor pointing to the start of table
+ * @brief initializes a latch that, once a writer waits, makes new readers wait too
+ */
+void latch_init_prefer_writer(pthread_rwlock_t *latch);
+
+/**
+ * Takes the frame latch that the cursor latch mode calls for, if any
+ */
+void pager_latch(Pager *pager, uint32_t page_num, CursorLatch latch);
+
+void pager_unlatch(Pager *pager, uint32_t page_num, CursorLatch latch);
+
+void pager_count(_Atomic uint64_t *counter, uint64_t amount);
+
+/**
+ * @param flags DB_OPEN_* flags, 0 for the default in-place B+tree
+ * @return NULL if the file cannot be opened
+ */
+Table *db_open(const char *filename, uint32_t flags);
+
+/*
+ * Cursors are owned by the caller, usually on its stack: the lookups below fill one in, and
+ * cursor_close releases what it holds without freeing it.
  */
-Cursor *table_start(Table *table);
 
-Cursor *table_find(Table *table, uint32_t key);
+/**
+ * @brief points cursor at the start of table
+ */
+void table_start(Table *table, Cursor *cursor);
+
+/**
+ * Read-only lookup. Crabs shared latches from the root down and returns with the leaf latched shared.
+ * On a sharded table, looks in the shard that owns key.
+ */
+void table_find(Table *table, uint32_t key, Cursor *cursor);
+
+/**
+ * @brief points cursor at the last row, for cursor_retreat; end_of_table if the table is empty.
+ * Hash tables have no last row.
+ */
+void table_end(Table *table, Cursor *cursor);
+
+/**
+ * table_start / table_end / table_find that skip the memtable, see memtable.h
+ */
+void tree_start(Table *table, Cursor *cursor);
+
+void tree_end(Table *table, Cursor *cursor);
+
+void tree_find(Table *table, uint32_t key, Cursor *cursor);
+
+/**
+ * Lookup for an insert. Optimistically latches only the leaf exclusive; if the leaf is full and
+ * would split, restarts with the tree latch held exclusive.
+ * In copy-on-write mode, starts a write transaction that cursor_close commits.
+ */
+void table_find_for_insert(Table *table, uint32_t key, Cursor *cursor);
+
+/**
+ * @return true if the cursor from table_find / table_find_for_insert is on a row with this key
+ */
+bool cursor_holds_key(Cursor *cursor, uint32_t key);
+
+/**
+ * @brief releases every latch held by the cursor; the cursor itself stays the caller's
+ */
+void cursor_close(Cursor *cursor);
 
 NodeType get_node_type(void *node);
 
@@ -142,8 +352,29 @@ uint32_t *leaf_node_key(void *node, uint32_t cell_num);
 
 uint32_t *leaf_node_num_cells(void *node);
 
+void *leaf_node_cell(void *node, uint32_t cell_num);
+
+uint32_t *leaf_node_next_leaf(void *node);
+
+uint32_t *leaf_node_prev_leaf(void *node);
+
+uint32_t *node_parent(void *node);
+
+/**
+ * @brief the root has no parent, so page 0 keeps BTREE_FORMAT_MAGIC in that field
+ */
+uint32_t *root_node_format(void *root);
+
+void initialize_leaf_node(void *node);
+
+void initialize_internal_node(void *node);
+
+void set_node_root(void *node, bool is_root);
+
 void *cursor_value(Cursor *cursor);
 
+uint32_t cursor_key(Cursor *cursor);
+
 // 返回第 page_num 页的起始位置的指针
 void *get_page(Pager *pager, uint32_t page_num);
 
@@ -156,11 +387,34 @@ void *leaf_node_value(void *node, uint32_t cell_num);
  */
 void cursor_advance(Cursor *cursor);
 
-void db_close(Table *table);
+/**
+ * @brief moves the cursor back one row; end_of_table once it steps before the first one
+ */
+void cursor_retreat(Cursor *cursor);
+
+/**
+ * @brief writes every cached page back and frees the table, even if some writes fail
+ * @return false if any page could not be written or the file could not be closed, or if the
+ * pager failed earlier
+ */
+bool db_close(Table *table);
+
+/**
+ * Snapshots the counters, then walks the tree under the shared tree latch for its shape
+ */
+void table_stats(Table *table, TableStats *stats);
 
 void deserialize_row(const void *source, Row *destination);
 
-void leaf_node_insert(const Cursor *cursor, uint32_t key, const Row *value);
+/**
+ * @brief checks that inserting key at the cursor will not run out of pages
+ */
+bool table_can_insert(const Cursor *cursor, uint32_t key);
+
+/**
+ * @param value ROW_SIZE bytes, already serialized
+ */
+void leaf_node_insert(const Cursor *cursor, uint32_t key, const void *value);
 
 void serialize_row(const Row *source, void *destination);
 
@@ -0,0 +1,32 @@
+#ifndef SIMPLE_DATABASE_VACUUM_H
+#define SIMPLE_DATABASE_VACUUM_H
+
+#include "../inc/store.h"
+
+/*
+ * Rebuilds a table into {filename}.vacuum and renames it over the original.
+ * The new file holds the root on page 0, then every leaf in key order on consecutive pages, then the
+ * internal nodes level by level, so a full scan reads the file front to back.
+ */
+
+#define VACUUM_DEFAULT_FILL 100
+
+typedef enum {
+    VACUUM_SUCCESS,
+    VACUUM_HASH_TABLE,   // Buckets have no key order to lay out
+    VACUUM_SNAPSHOT_OPEN,// Copy-on-write mode, and a reader still pins an old version
+    VACUUM_TOO_LARGE,    // The rebuilt tree would not fit in TABLE_MAX_PAGES
+    VACUUM_IO_ERROR,     // The new file could not be written, or the renamed file not reopened
+} VacuumResult;
+
+/**
+ * Takes the tree latch exclusive, so the table may be shared with other threads. In copy-on-write
+ * mode it takes the writer lock instead and holds off new snapshot readers until the swap is done;
+ * a reader already pinned makes it return VACUUM_SNAPSHOT_OPEN.
+ * @param fill_percent how full to pack each leaf, 1 to 100
+ * @return anything but VACUUM_SUCCESS leaves the rows where they were. If the renamed file cannot be
+ * reopened, the table keeps its old frames but its pager is marked failed.
+ */
+VacuumResult table_vacuum(Table *table, uint32_t fill_percent);
+
+#endif //SIMPLE_DATABASE_VACUUM_H
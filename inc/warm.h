@@ -0,0 +1,40 @@
+#ifndef SIMPLE_DATABASE_WARM_H
+#define SIMPLE_DATABASE_WARM_H
+
+#include "../inc/store.h"
+
+/*
+ * Warm start.
+ * db_close records a bounded hot subset of the resident pages in a {filename}.warm sidecar: a magic,
+ * a count and the page numbers in ascending order. The subset is every resident internal node, then
+ * the most recently used of the other pages, up to WARM_SET_MAX_PAGES in all. db_open reads those
+ * pages back before the first statement, in one batch with a vectored read per run of consecutive
+ * pages straight into the frames, so the first queries after a restart find the root, the internal
+ * nodes and the hot leaves already cached, without a full scan last session making the next open
+ * read the whole file.
+ * The sidecar is only a hint: a missing, stale or torn one just means more get_page misses.
+ */
+
+#define WARM_SET_SUFFIX ".warm"
+#ifndef WARM_SET_RUN_PAGES
+#define WARM_SET_RUN_PAGES IO_RUN_PAGES
+#endif
+#ifndef WARM_SET_MAX_PAGES
+#define WARM_SET_MAX_PAGES 4096// 16MB read at open
+#endif
+
+/**
+ * Must run before the pager's frames are freed
+ * @param btree the pages are B+tree nodes, so internal ones can be told apart and always kept
+ * @return false if the sidecar could not be written
+ */
+bool warm_set_save(const Pager *pager, bool btree);
+
+/**
+ * Reads at most WARM_SET_MAX_PAGES pages, whatever the sidecar lists. Pages already resident are kept,
+ * since they may be newer than the file.
+ * Must run before the pager is shared with other threads
+ */
+void warm_set_load(Pager *pager);
+
+#endif //SIMPLE_DATABASE_WARM_H
@@ -1,5 +1,11 @@
+import ctypes
+import json
 import os
+import random
+import re
 import subprocess
+import threading
+import time
 from functools import wraps
 from typing import List, Callable
 
@@ -29,20 +35,39 @@ def db_context_manage(f: Callable) -> Callable:
     def wrapper(*args, **kwargs):
         if os.path.exists(args[0]):
             os.remove(args[0])
+        remove_warm_set(args[0])
+        remove_catalog(args[0])
         res = f(*args, **kwargs)
         os.remove(args[0])
+        remove_warm_set(args[0])
+        remove_catalog(args[0])
         return res
 
     return wrapper
 
 
-def run_sql_commands(dbname: str, commands: List[str]) -> List[str]:
+def remove_warm_set(dbname: str):
+    """删除 db_close 留下的预读页列表"""
+    if os.path.exists(f"{dbname}.warm"):
+        os.remove(f"{dbname}.warm")
+
+
+def remove_catalog(dbname: str):
+    """删除 create table 写下的表结构"""
+    if os.path.exists(f"{dbname}.catalog"):
+        os.remove(f"{dbname}.catalog")
+
+
+def run_sql_commands(dbname: str, commands: List[str], options: List[str] = (),
+                     binary: str = "./simple_db") -> List[str]:
     """在给定的进程上运行多个 SQL 命令并返回输出
     :param dbname:
     :param commands:
+    :param options: 额外的命令行参数, 如 --cow
+    :param binary: 要运行的 REPL, 如 ./simple_db_large
     """
     process = subprocess.Popen(
-        ["./simple_db", f"{dbname}"],
+        [binary, *options, f"{dbname}"],
         stdin=subprocess.PIPE,
         stdout=subprocess.PIPE,
         text=True,
@@ -179,9 +204,9 @@ def test_print_constants(dbname):
         "db > Constants: ",
         "ROW_SIZE: 293",
         "COMMON_NODE_HEADER_SIZE: 6",
-        "LEAF_NODE_HEADER_SIZE: 14",
+        "LEAF_NODE_HEADER_SIZE: 18",
         "LEAF_NODE_CELL_SIZE: 297",
-        "LEAF_NODE_SPACE_FOR_CELLS: 4082",
+        "LEAF_NODE_SPACE_FOR_CELLS: 4078",
         "LEAF_NODE_MAX_CELLS: 13",
         "db > ",
     ]
@@ -319,10 +344,868 @@ def test_print_4_leaf_node_btree(dbname):
     assert output[30:] == expect
 
 
+def check_btree(lines: List[str], max_keys: int) -> (int, List[int]):
+    """检查 .btree 的输出: 叶子深度相同, 内部节点的 key 数不超过 max_keys, 每个 key 等于左边子树的最大 key
+
+    :return: 树的高度和按顺序的所有 key
+    """
+    assert lines[0] == "db > Tree:"
+    position = 1
+
+    def node(depth: int) -> (int, List[int]):
+        nonlocal position
+        line = lines[position]
+        indent = "  " * depth + "- "
+        assert line.startswith(indent), line
+        kind, size = line[len(indent):].removesuffix(")").split(" (size ")
+        size = int(size)
+        position += 1
+        if kind == "leaf":
+            keys = [int(lines[position + i].removeprefix(indent[:-2] + "  - ")) for i in range(size)]
+            position += size
+            return 1, keys
+        assert kind == "internal" and 1 <= size <= max_keys, line
+        height, keys = node(depth + 1)
+        for _ in range(size):
+            separator = int(lines[position].removeprefix(indent[:-2] + "  - key "))
+            position += 1
+            assert separator == keys[-1], (separator, keys[-1])
+            child_height, child_keys = node(depth + 1)
+            assert child_height == height
+            keys += child_keys
+        return height + 1, keys
+
+    result = node(0)
+    assert position == len(lines)
+    return result
+
+
+@log_func
+@db_context_manage
+def test_internal_node_split(dbname: str, binary: str = "./simple_db", max_keys: int = 3, rows: int = 120):
+    """插入足够多的行, 让内部节点分裂, 根节点分裂两次 (树高 4); 检查 .btree 结构和 select 的顺序
+
+    :param binary: ./simple_db_large 按基准测试的 INTERNAL_NODE_MAX_KEYS 编译, 要插入近百万行
+    :param max_keys: 内部节点最多的 key 数, 与 binary 编译时一致
+    :param rows: 顺序插入时让根节点分裂两次的行数
+    """
+    # 顺序插入每个叶子留 7 行; 乱序插入的顺序固定, 只在小扇出时跑
+    key_lists = [list(range(1, rows + 1)), list(range(rows, 0, -1))]
+    if max_keys == 3:
+        key_lists.append([(i * 89) % 251 + 1 for i in range(251)])
+    for keys in key_lists:
+        if os.path.exists(dbname):
+            os.remove(dbname)
+        remove_warm_set(dbname)
+        commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+        commands += [".btree", ".exit"]
+        output = run_sql_commands(dbname, commands, binary=binary)
+        assert output[:len(keys)] == ["db > Executed."] * len(keys)
+        height, tree_keys = check_btree(output[len(keys):-1], max_keys)
+        assert height == 4
+        assert tree_keys == sorted(keys)
+
+        # 重新打开后父指针和叶子链表仍然正确
+        expect = [f"{i} user{i} person{i}@example.com" for i in sorted(keys)]
+        output = run_sql_commands(dbname, ["select", f"insert {max(keys) + 1} a b", ".btree", ".exit"],
+                                  binary=binary)
+        assert output[:len(expect) + 2] == ["db > " + expect[0]] + expect[1:] + ["Executed.", "db > Executed."]
+        height, tree_keys = check_btree(output[len(expect) + 2:-1], max_keys)
+        assert tree_keys == sorted(keys) + [max(keys) + 1]
+
+
+@log_func
+@db_context_manage
+def test_copy_on_write_mode(dbname):
+    """copy-on-write 模式下的插入, 快照扫描, 以及关闭后以普通模式重新打开"""
+    keys = [18, 7, 10, 29, 23, 4, 14, 30, 15, 26, 22, 19, 2, 1, 21, 11, 6, 20, 5, 8, 9, 3, 12, 27, 17, 16, 13, 24,
+            25, 28]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    commands.append("insert 7 dup dup")
+    commands.append("select")
+    commands.append(".exit")
+    output = run_sql_commands(dbname, commands, ["--cow"])
+    print(output[30:32])
+
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 31)]
+    assert output[30] == "db > Error: Duplicate key."
+    assert output[31:] == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > "]
+
+    output = run_sql_commands(dbname, ["select", ".btree", ".exit"])
+    assert output[:31] == ["db > " + rows[0]] + rows[1:] + ["Executed."]
+    assert output[31:34] == ["db > Tree:", "- internal (size 3)", "  - leaf (size 7)"]
+
+    # 每次会话被替换掉的页, 下次以 copy-on-write 打开时回收, 文件不会一直变大
+    for i in range(31, 51):
+        output = run_sql_commands(dbname, [f"insert {i} user{i} person{i}@example.com", ".exit"], ["--cow"])
+        assert output == ["db > Executed.", "db > "]
+    print(os.path.getsize(dbname) // 4096)
+    assert os.path.getsize(dbname) <= 16 * 4096
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 51)]
+    assert output == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > "]
+
+
+@log_func
+@db_context_manage
+def test_sharded_table(dbname):
+    """按 id 哈希分片到多个文件, select 按 id 顺序合并各分片"""
+    shard_files = [f"{dbname}.{i}" for i in range(4)]
+    keys = [18, 7, 10, 29, 23, 4, 14, 30, 15, 26, 22, 19, 2, 1, 21, 11, 6, 20, 5, 8, 9, 3, 12, 27, 17, 16, 13, 24,
+            25, 28]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    commands.append("insert 7 dup dup")
+    commands.append(".exit")
+    output = run_sql_commands(dbname, commands, ["--shards", "4"])
+    assert output[30] == "db > Error: Duplicate key."
+    assert all(os.path.getsize(f) > 0 for f in shard_files)
+
+    # the manifest remembers the shard count
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 31)]
+    print(output[:3])
+    assert output == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > "]
+
+    output = run_sql_commands(dbname, [".exit"], ["--shards", "2"])
+    assert output == ["Unable to open file"]
+    for f in shard_files:
+        os.remove(f)
+        remove_warm_set(f)
+
+
+class Row(ctypes.Structure):
+    _fields_ = [("id", ctypes.c_uint32), ("username", ctypes.c_char * 33), ("email", ctypes.c_char * 256)]
+
+
+@log_func
+@db_context_manage
+def test_library_api(dbname):
+    """通过 libsimple_db.so 的嵌入式 API 插入和查询"""
+    lib = ctypes.CDLL("./libsimple_db.so")
+    lib.simple_db_bind_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_int64]
+    lib.simple_db_bind_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p]
+    lib.simple_db_step.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+    for name in ["simple_db_reset", "simple_db_finalize", "simple_db_close"]:
+        getattr(lib, name).argtypes = [ctypes.c_void_p]
+    ok, row_ready, done, syntax_error, duplicate_key, range_error, unbound = 0, 1, 2, 5, 9, 11, 12
+
+    db = ctypes.c_void_p()
+    assert lib.simple_db_open(dbname.encode(), 0, ctypes.byref(db)) == ok
+    stmt = ctypes.c_void_p()
+    assert lib.simple_db_prepare(db, b"insert 1 2", ctypes.byref(stmt)) == syntax_error
+    assert lib.simple_db_prepare(db, b"insert ? ? ?", ctypes.byref(stmt)) == ok
+
+    row = ctypes.POINTER(Row)()
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == unbound
+    assert lib.simple_db_bind_text(stmt, 1, b"yan") == range_error
+    for i, expect in [(2, done), (1, done), (3, done), (2, duplicate_key)]:
+        lib.simple_db_reset(stmt)
+        assert lib.simple_db_bind_int(stmt, 1, i) == ok
+        assert lib.simple_db_bind_text(stmt, 2, f"user{i}".encode()) == ok
+        assert lib.simple_db_bind_text(stmt, 3, f"user{i}@example.com".encode()) == ok
+        assert lib.simple_db_step(stmt, ctypes.byref(row)) == expect
+    lib.simple_db_finalize(stmt)
+
+    assert lib.simple_db_prepare(db, b"select", ctypes.byref(stmt)) == ok
+    rows = []
+    while lib.simple_db_step(stmt, ctypes.byref(row)) == row_ready:
+        rows.append((row.contents.id, row.contents.username, row.contents.email))
+    lib.simple_db_finalize(stmt)
+    print(rows)
+    assert rows == [(i, f"user{i}".encode(), f"user{i}@example.com".encode()) for i in [1, 2, 3]]
+
+    # 按 id 查找最多一行
+    for sql, expect in [(b"select where id = 2", [2]), (b"select where id = 9", []),
+                        (b"select where id = 2 limit 0", []), (b"select order by id desc limit 2", [3, 2])]:
+        assert lib.simple_db_prepare(db, sql, ctypes.byref(stmt)) == ok
+        ids = []
+        while lib.simple_db_step(stmt, ctypes.byref(row)) == row_ready:
+            ids.append(row.contents.id)
+        lib.simple_db_finalize(stmt)
+        assert ids == expect
+
+    # users 行也能按列读取
+    lib.simple_db_column_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_char_p)]
+    lib.simple_db_column_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_int64)]
+    assert lib.simple_db_prepare(db, b"select where id = 3", ctypes.byref(stmt)) == ok
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == row_ready
+    key, email = ctypes.c_int64(), ctypes.c_char_p()
+    assert lib.simple_db_column_int(stmt, 0, ctypes.byref(key)) == ok and key.value == 3
+    assert lib.simple_db_column_text(stmt, 2, ctypes.byref(email)) == ok and email.value == b"user3@example.com"
+    assert lib.simple_db_column_int(stmt, 1, ctypes.byref(key)) == range_error
+    lib.simple_db_finalize(stmt)
+    assert lib.simple_db_close(db) == ok
+
+
+@log_func
+@db_context_manage
+def test_stats(dbname):
+    """.stats 输出引擎计数器, .stats json 输出同样内容的 JSON"""
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 41)]
+    commands.append(".stats json")
+    commands.append(".exit")
+    output = run_sql_commands(dbname, commands)
+    stats = json.loads(output[-2].removeprefix("db > "))
+    print(stats)
+    assert stats["rows"] == 40
+    assert stats["tree_height"] == 3
+    assert stats["leaf_pages"] == stats["leaf_splits"] + 1
+    assert stats["internal_splits"] == 1
+    assert stats["num_pages"] == stats["leaf_pages"] + stats["internal_pages"]
+    assert stats["pages_written"] == 0
+
+    # 没有预读页列表时, 重新打开后第一次访问每一页都要从文件读取; select 顺着叶子链表走, 不会访问右侧的内部节点
+    remove_warm_set(dbname)
+    output = run_sql_commands(dbname, ["select", ".stats", ".exit"])
+    print(output[-7:])
+    assert output[-7] == "db > cache: 80 hits, 7 misses (92.0% hit rate)"
+    assert output[-6] == "reads: 7 pages, 28672 bytes"
+    assert output[-4] == "splits: 0 leaf, 0 internal"
+    assert output[-3] == "tree: height 3, 5 leaf pages, 3 internal pages, 8 pages in file"
+    assert output[-2] == "rows: 40, leaf fill 61.5%"
+
+
+@log_func
+@db_context_manage
+def test_timer_and_profile(dbname):
+    """.timer on 在每条语句后输出耗时, .profile 输出各阶段的延迟直方图"""
+    commands = [".timer on", ".profile on"]
+    commands.extend(f"insert {i} user{i} person{i}@example.com" for i in range(1, 4))
+    commands.extend(["select", ".timer off", "insert 4 user4 person4@example.com", ".profile", ".exit"])
+    output = run_sql_commands(dbname, commands)
+    print(output)
+    assert output[2] == "db > Executed."
+    assert re.fullmatch(r"Run Time: real \d+\.\d{6} cpu \d+\.\d{6}", output[3])
+    assert output[-10] == "db > Executed."
+    assert output[-9].split() == ["db", ">", "point", "count", "mean_us", "p50_us", "p99_us", "p999_us", "max_us"]
+    counts = {line.split()[0]: int(line.split()[1]) for line in output[-8:-1]}
+    assert counts == {"insert": 4, "select": 1, "prepare": 5, "find": 5, "get_page_io": 0, "split": 0,
+                      "print_row": 3}
+
+
+@log_func
+@db_context_manage
+def test_vacuum(dbname):
+    """.vacuum 把随机插入后半满的叶子按 key 顺序重新排到连续的页上"""
+    keys = [18, 7, 10, 29, 23, 4, 14, 30, 15, 26, 22, 19, 2, 1, 21, 11, 6, 20, 5, 8]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    commands.extend([".vacuum 101", ".vacuum", ".stats json", ".exit"])
+    output = run_sql_commands(dbname, commands)
+    assert output[-4] == "db > Fill factor must be between 1 and 100"
+    stats = json.loads(output[-2].removeprefix("db > "))
+    print(stats)
+    assert stats["rows"] == 20
+    assert stats["leaf_pages"] == 2
+    assert stats["num_pages"] == 3
+
+    # 叶子紧跟在根节点之后: 第 1 页和第 2 页, 且第 1 页的 next 指向第 2 页
+    with open(dbname, "rb") as f:
+        data = f.read()
+    page_size = 4096
+    assert len(data) == 3 * page_size
+    assert [data[i * page_size] for i in range(3)] == [1, 0, 0]
+    assert int.from_bytes(data[page_size + 10:page_size + 14], "little") == 2
+
+    output = run_sql_commands(dbname, ["select", "insert 3 user3 person3@example.com", ".exit"])
+    assert output[:-2] == ["db > 1 user1 person1@example.com"] + [
+        f"{i} user{i} person{i}@example.com" for i in sorted(keys)[1:]] + ["Executed."]
+    assert output[-2] == "db > Executed."
+
+
+@log_func
+@db_context_manage
+def test_background_flush(dbname):
+    """后台线程会把一段时间没有修改的脏页写回文件, 不必等到 .exit"""
+    process = subprocess.Popen(
+        ["./simple_db", f"{dbname}"],
+        stdin=subprocess.PIPE,
+        stdout=subprocess.PIPE,
+        text=True,
+    )
+    process.stdin.write("".join(f"insert {i} user{i} person{i}@example.com\n" for i in range(1, 41)))
+    process.stdin.flush()
+    # 至少经过两个 flusher 周期, 页面才算冷页
+    time.sleep(0.5)
+    output, _ = process.communicate(input=".stats json\n.exit\n")
+    output = list(filter(lambda x: x != "", output.split("\n")))
+    stats = json.loads(output[-2].removeprefix("db > "))
+    print(stats)
+    assert stats["pages_written"] == stats["num_pages"]
+    assert stats["bytes_written"] == stats["num_pages"] * 4096
+
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["db > 1 user1 person1@example.com"] + [
+        f"{i} user{i} person{i}@example.com" for i in range(2, 41)] + ["Executed.", "db > "]
+
+
+@log_func
+@db_context_manage
+def test_warm_start(dbname):
+    """.exit 记录缓存中的页, 重新打开时一次性按文件顺序读回"""
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 41)]
+    commands.append(".exit")
+    run_sql_commands(dbname, commands)
+    assert os.path.getsize(f"{dbname}.warm") == 12 + 8 * 4
+
+    output = run_sql_commands(dbname, ["select", ".stats", ".exit"])
+    print(output[-7:])
+    assert output[-7] == "db > cache: 87 hits, 0 misses (100.0% hit rate)"
+    assert output[-6] == "reads: 8 pages, 32768 bytes"
+
+    # 只读回上次访问过的页: select 不会访问右侧的内部节点
+    remove_warm_set(dbname)
+    run_sql_commands(dbname, ["select", ".exit"])
+    output = run_sql_commands(dbname, [".stats", ".exit"])
+    assert output[-6] == "reads: 7 pages, 28672 bytes"
+
+    # 损坏的列表会被忽略
+    with open(f"{dbname}.warm", "r+b") as f:
+        f.truncate(20)
+    output = run_sql_commands(dbname, ["select", ".stats", ".exit"])
+    assert output[-7] == "db > cache: 80 hits, 7 misses (92.0% hit rate)"
+
+    # 扫描过整张大表之后, 列表只留内部节点和最近用过的叶子, 最多 4096 页
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 40001)]
+    commands += ["select", ".exit"]
+    run_sql_commands(dbname, commands, binary="./simple_db_large")
+    assert os.path.getsize(f"{dbname}.warm") == 12 + 4096 * 4
+    for key, misses in [(40000, 0), (1, 1)]:
+        output = run_sql_commands(dbname, [f"select where id = {key}", ".stats", ".exit"], binary="./simple_db_large")
+        assert output[-6] == f"reads: {4096 + misses} pages, {(4096 + misses) * 4096} bytes"
+        assert re.fullmatch(rf"db > cache: \d+ hits, {misses} misses .*", output[-7]), output[-7]
+        remove_warm_set(dbname)
+        run_sql_commands(dbname, commands[-2:], binary="./simple_db_large")
+
+
+@log_func
+@db_context_manage
+def test_io_uring(dbname):
+    """--io-uring 走 io_uring 读写页面; 内核不支持时退回普通系统调用, 结果应完全一样"""
+    keys = [(i * 37) % 200 + 1 for i in range(200)]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    commands.append(".exit")
+    run_sql_commands(dbname, commands, ["--io-uring"])
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 201)]
+
+    # 预读, 查询, vacuum 之后再用系统调用读一遍
+    output = run_sql_commands(dbname, ["select", ".vacuum", "insert 201 a b", ".exit"], ["--io-uring"])
+    assert output[:201] == ["db > " + rows[0]] + rows[1:] + ["Executed."]
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["db > " + rows[0]] + rows[1:] + ["201 a b", "Executed.", "db > "]
+
+
+@log_func
+@db_context_manage
+def test_create_table(dbname):
+    """create table 定义带类型的列, 插入按列编码, 表结构存在 .catalog 里, 重新打开后仍然有效"""
+    output = run_sql_commands(dbname, [
+        "create table items (id int32, name varchar(16), count int64, price double, tag char(4))",
+        ".schema",
+        "insert 2 bob 9000000000 2.5 ab",
+        "insert 1 alice -5 0.1 xyzw",
+        "insert 1 carol 1 1 a",
+        "insert 3 dave 1 1 toolong",
+        "insert 3 dave x 1 a",
+        "insert 3 dave 1",
+        "insert -1 dave 1 1 a",
+        "create table again (id int32)",
+        ".exit",
+    ])
+    assert output == [
+        "db > Executed.",
+        "db > create table items (id int32, name varchar(16), count int64, price double, tag char(4))",
+        "db > Executed.",
+        "db > Executed.",
+        "db > Error: Duplicate key.",
+        "db > String is too long",
+        "db > Syntax error. Could not parse statement.",
+        "db > Syntax error. Could not parse statement.",
+        "db > Cannot insert negative id",
+        "db > Error: Table already exists.",
+        "db > ",
+    ]
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["db > 1 alice -5 0.1 xyzw", "2 bob 9000000000 2.5 ab", "Executed.", "db > "]
+
+    # where 按列用编解码器的比较函数过滤; 键列按名字单点查找
+    output = run_sql_commands(dbname, [
+        "select where name = bob",
+        "select where count < 0",
+        "select where price > 0.5",
+        "select where tag > xy",
+        "select where id = 2",
+        "select where id > 1",
+        "select where count = x",
+        "select where name = seventeen_letters",
+        "insert 3 ? 1 1 a",
+        ".exit",
+    ])
+    assert output == [
+        "db > 2 bob 9000000000 2.5 ab", "Executed.",
+        "db > 1 alice -5 0.1 xyzw", "Executed.",
+        "db > 2 bob 9000000000 2.5 ab", "Executed.",
+        "db > 1 alice -5 0.1 xyzw", "Executed.",
+        "db > 2 bob 9000000000 2.5 ab", "Executed.",
+        "db > 2 bob 9000000000 2.5 ab", "Executed.",
+        "db > Syntax error. Could not parse statement.",
+        "db > String is too long",
+        "db > Parameters can only be bound through the library API.",
+        "db > ",
+    ]
+
+    # 库接口: 参数按列经编解码器绑定, 结果按列读取
+    lib = ctypes.CDLL("./libsimple_db.so")
+    lib.simple_db_bind_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_int64]
+    lib.simple_db_bind_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p]
+    lib.simple_db_bind_double.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_double]
+    lib.simple_db_step.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+    lib.simple_db_column_count.argtypes = [ctypes.c_void_p]
+    lib.simple_db_column_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_int64)]
+    lib.simple_db_column_double.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_double)]
+    lib.simple_db_column_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.POINTER(ctypes.c_char_p)]
+    for name in ["simple_db_reset", "simple_db_finalize", "simple_db_close"]:
+        getattr(lib, name).argtypes = [ctypes.c_void_p]
+    ok, row_ready, done, too_long, negative_id, range_error, unbound = 0, 1, 2, 7, 8, 11, 12
+
+    db = ctypes.c_void_p()
+    stmt = ctypes.c_void_p()
+    row = ctypes.POINTER(Row)()
+    assert lib.simple_db_open(dbname.encode(), 0, ctypes.byref(db)) == ok
+    assert lib.simple_db_prepare(db, b"insert ? ? ? ? xy", ctypes.byref(stmt)) == ok
+    assert lib.simple_db_bind_int(stmt, 1, -1) == negative_id
+    assert lib.simple_db_bind_int(stmt, 1, 1 << 40) == range_error
+    assert lib.simple_db_bind_int(stmt, 2, 5) == range_error
+    assert lib.simple_db_bind_double(stmt, 3, 1.5) == range_error
+    assert lib.simple_db_bind_text(stmt, 2, b"seventeen_letters") == too_long
+    assert lib.simple_db_bind_int(stmt, 5, 1) == range_error
+    assert lib.simple_db_bind_int(stmt, 1, 3) == ok
+    assert lib.simple_db_bind_text(stmt, 2, b"carol") == ok
+    assert lib.simple_db_bind_int(stmt, 3, 1 << 40) == ok
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == unbound
+    assert lib.simple_db_bind_int(stmt, 4, 7) == ok
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == done
+    lib.simple_db_reset(stmt)
+    # 重新绑定更短的字符串, 旧值不留残余
+    assert lib.simple_db_bind_text(stmt, 1, b"4") == ok
+    assert lib.simple_db_bind_text(stmt, 2, b"dan") == ok
+    assert lib.simple_db_bind_text(stmt, 3, b"-2") == ok
+    assert lib.simple_db_bind_double(stmt, 4, 0.25) == ok
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == done
+    lib.simple_db_finalize(stmt)
+
+    assert lib.simple_db_prepare(db, b"select where id > 2", ctypes.byref(stmt)) == ok
+    records = []
+    while lib.simple_db_step(stmt, ctypes.byref(row)) == row_ready:
+        assert not row and lib.simple_db_column_count(stmt) == 5
+        key, count, price, text = ctypes.c_int64(), ctypes.c_int64(), ctypes.c_double(), ctypes.c_char_p()
+        assert lib.simple_db_column_int(stmt, 0, ctypes.byref(key)) == ok
+        assert lib.simple_db_column_int(stmt, 2, ctypes.byref(count)) == ok
+        assert lib.simple_db_column_double(stmt, 3, ctypes.byref(price)) == ok
+        assert lib.simple_db_column_int(stmt, 3, ctypes.byref(count)) == range_error
+        assert lib.simple_db_column_text(stmt, 5, ctypes.byref(text)) == range_error
+        assert lib.simple_db_column_text(stmt, 1, ctypes.byref(text)) == ok
+        name = text.value
+        assert lib.simple_db_column_text(stmt, 4, ctypes.byref(text)) == ok
+        records.append((key.value, name, count.value, price.value, text.value))
+    assert lib.simple_db_column_count(stmt) == 0
+    lib.simple_db_finalize(stmt)
+    assert lib.simple_db_close(db) == ok
+    assert records == [(3, b"carol", 1 << 40, 7.0, b"xy"), (4, b"dan", -2, 0.25, b"xy")]
+
+    # 放不进一个叶子单元, 或者键不是 int32
+    remove_catalog(dbname)
+    os.remove(dbname)
+    output = run_sql_commands(dbname, [
+        "create table wide (id int32, a char(100), b char(100), c char(100))",
+        "create table bad (name char(8), id int32)",
+        ".schema",
+        ".exit",
+    ])
+    assert output == [
+        "db > Row is too wide",
+        "db > Syntax error. Could not parse statement.",
+        "db > create table users (id int32, username char(32), email char(255))",
+        "db > ",
+    ]
+
+
+@log_func
+@db_context_manage
+def test_hash_table(dbname):
+    """--hash 建立可扩展哈希表: 按 id 单点查找和插入, select 不保证顺序, 文件自己记得布局"""
+    keys = [(i * 37) % 200 + 1 for i in range(200)]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    commands += ["insert 5 a b", "select where id = 77", "select where id = 999", ".stats", ".exit"]
+    output = run_sql_commands(dbname, commands, ["--hash"])
+    assert output[200:204] == [
+        "db > Error: Duplicate key.",
+        "db > 77 user77 person77@example.com",
+        "Executed.",
+        "db > Executed.",
+    ]
+    # 200 行分进 21 个桶, 加上头页和目录页
+    assert output[208] == "tree: height 5, 21 leaf pages, 2 internal pages, 23 pages in file"
+    assert output[209] == "rows: 200, leaf fill 73.3%"
+
+    # 不带 --hash 也按哈希表打开; 全表扫描每行恰好一次
+    output = run_sql_commands(dbname, ["select", "select where id = 200", ".vacuum", ".exit"])
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 201)]
+    output[0] = output[0][len("db > "):]
+    assert sorted(output[:200], key=lambda row: int(row.split()[0])) == rows
+    assert output[200:] == [
+        "Executed.",
+        "db > 200 user200 person200@example.com",
+        "Executed.",
+        "db > Error: Hash tables have no key order.",
+        "db > ",
+    ]
+
+    # B+tree 文件不能变成哈希表
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    run_sql_commands(dbname, ["insert 1 a b", ".exit"])
+    output = run_sql_commands(dbname, [".exit"], ["--hash"])
+    assert output == ["Unable to open file"]
+
+
+@log_func
+@db_context_manage
+def test_memtable(dbname):
+    """--memtable 先把插入缓存在内存跳表里, 满了再按叶子批量合并进 B+ 树; 读取同时看到两边"""
+    keys = [(i * 37) % 100 + 1 for i in range(100)]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    # 38 还在跳表里, 1 已经合并进树
+    commands += ["insert 38 a b", "insert 1 a b", "select where id = 38", "select where id = 1", ".stats", "select"]
+    commands += [".exit"]
+    output = run_sql_commands(dbname, commands, ["--memtable", "16"])
+    assert output[100:106] == [
+        "db > Error: Duplicate key.",
+        "db > Error: Duplicate key.",
+        "db > 38 user38 person38@example.com",
+        "Executed.",
+        "db > 1 user1 person1@example.com",
+        "Executed.",
+    ]
+    # 每批最多 16 行; 空闲页不够最坏情况的合并时提前合并, 剩下 9 行还没写进树
+    assert output[111:113] == ["rows: 91, leaf fill 77.8%", "memtable: 9 rows"]
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 101)]
+    assert output[113:] == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > "]
+
+    # 关闭时缓存的行全部落盘
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > "]
+
+    # 表满时已经确认的行一行不丢: 跳表只在最坏情况的合并也放得下时才缓存
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    keys = random.Random(1).sample(range(1, 100000), 1300)
+    output = run_sql_commands(dbname, [f"insert {i} user{i} person{i}@example.com" for i in keys] + [".exit"],
+                              ["--memtable", "50"])
+    acknowledged = [i for i, line in zip(keys, output) if line == "db > Executed."]
+    assert output[-2] == "db > Error: Table full." and len(acknowledged) > 650
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert [int(line.split()[-3]) for line in output[:-2]] == sorted(acknowledged)
+
+    # 哈希表不能带跳表
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    output = run_sql_commands(dbname, [".exit"], ["--hash", "--memtable", "16"])
+    assert output == ["Unable to open file"]
+
+
+@log_func
+@db_context_manage
+def test_large_file(dbname):
+    """超过 4GB 的 (稀疏) 文件: 长度按 64 位计算, 页数超过 TABLE_MAX_PAGES 时拒绝打开, 不会越界"""
+    run_sql_commands(dbname, ["insert 1 user1 person1@example.com", ".exit"])
+    with open(dbname, "r+b") as f:
+        f.truncate(5 * 1024 ** 3 + 4096)
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["Unable to open file"]
+
+    # 截回原来的长度, 数据还在
+    with open(dbname, "r+b") as f:
+        f.truncate(4096)
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["db > 1 user1 person1@example.com", "Executed.", "db > "]
+
+    # 基准测试的构建能寻址 8GB: 5GB 稀疏文件之后新分配的页写在 4GB 以外, 重新打开后从磁盘读回
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    large = "./simple_db_large"
+    run_sql_commands(dbname, ["insert 1 user1 person1@example.com", ".exit"], binary=large)
+    with open(dbname, "r+b") as f:
+        f.truncate(5 * 1024 ** 3)
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(2, 41)] + [".exit"]
+    run_sql_commands(dbname, commands, binary=large)
+    remove_warm_set(dbname)
+    output = run_sql_commands(dbname, ["select", ".stats", ".exit"], binary=large)
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 41)]
+    assert output[:41] == ["db > " + rows[0]] + rows[1:] + ["Executed."]
+    assert output[42] == "reads: 6 pages, 24576 bytes"
+    assert output[45] == "tree: height 2, 5 leaf pages, 1 internal pages, 1310725 pages in file"
+    # 根留在第 0 页, 所有行都在 4GB 之后的页里; 中间没有写过的部分不占磁盘
+    with open(dbname, "rb") as f:
+        f.seek(5 * 1024 ** 3)
+        tail = f.read()
+    assert all(f"person{i}@example.com\0".encode() in tail for i in range(1, 41))
+    assert os.stat(dbname).st_blocks * 512 < 1024 ** 2
+
+
+@log_func
+@db_context_manage
+def test_corrupt_page_number(dbname):
+    """子节点页号超出 TABLE_MAX_PAGES: 不退出进程, 语句返回 I/O 错误, close 也报错, 文件不被改写"""
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in range(1, 21)]
+    commands.append(".exit")
+    run_sql_commands(dbname, commands)
+    # 根节点是内部节点, 右孩子页号在偏移 10 处
+    with open(dbname, "r+b") as f:
+        f.seek(10)
+        right_child = f.read(4)
+        f.seek(10)
+        f.write((5000).to_bytes(4, "little"))
+
+    process = subprocess.run(["./simple_db", dbname], input="select where id = 3\nselect where id = 20\n"
+                             "insert 21 a b\nselect\n.exit\n", capture_output=True, text=True)
+    assert [line for line in process.stdout.split("\n") if line != ""] == [
+        "db > 3 user3 person3@example.com",
+        "Executed.",
+        "db > Error: I/O error on the db file.",
+        "db > Error: I/O error on the db file.",
+        "db > Error: I/O error on the db file.",
+        "db > ",
+    ]
+    assert process.returncode != 0
+
+    lib = ctypes.CDLL("./libsimple_db.so")
+    lib.simple_db_step.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+    for name in ["simple_db_finalize", "simple_db_close"]:
+        getattr(lib, name).argtypes = [ctypes.c_void_p]
+    ok, done, io_error = 0, 2, 4
+    db = ctypes.c_void_p()
+    stmt = ctypes.c_void_p()
+    row = ctypes.POINTER(Row)()
+    assert lib.simple_db_open(dbname.encode(), 0, ctypes.byref(db)) == ok
+    assert lib.simple_db_prepare(db, b"select where id = 20", ctypes.byref(stmt)) == ok
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == io_error
+    assert lib.simple_db_step(stmt, ctypes.byref(row)) == done
+    lib.simple_db_finalize(stmt)
+    assert lib.simple_db_close(db) == io_error
+
+    # 改回页号, 所有行都还在
+    with open(dbname, "r+b") as f:
+        f.seek(10)
+        f.write(right_child)
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 21)]
+    assert output == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > "]
+
+
+@log_func
+@db_context_manage
+def test_order_by_desc(dbname):
+    """select order by id desc 顺着叶子的 prev 指针从最后一行往前走, limit 读够就停"""
+    keys = [(i * 7) % 30 + 1 for i in range(30)]
+    commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+    commands += ["select order by id desc limit 5", "select order by id desc", "select limit 3",
+                 "select order by id asc limit 0", "select limit -1", "select order by id desc limit 5 x", ".exit"]
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 31)]
+    desc = rows[::-1]
+    output = run_sql_commands(dbname, commands)
+    assert output[30:] == ["db > " + desc[0]] + desc[1:5] + ["Executed."] + \
+           ["db > " + desc[0]] + desc[1:] + ["Executed."] + \
+           ["db > " + rows[0]] + rows[1:3] + ["Executed.", "db > Executed.",
+                                              "db > Syntax error. Could not parse statement.",
+                                              "db > Syntax error. Could not parse statement.", "db > "]
+
+    # 写时复制模式下叶子的 prev 指针会过期, 快照读按 key 重新下降; 跳表里还没合并的行也要合并进来
+    for flags in [["--cow"], ["--memtable", "4"]]:
+        os.remove(dbname)
+        remove_warm_set(dbname)
+        commands = [f"insert {i} user{i} person{i}@example.com" for i in keys]
+        commands += ["select order by id desc", ".exit"]
+        output = run_sql_commands(dbname, commands, flags)
+        assert output[30:] == ["db > " + desc[0]] + desc[1:] + ["Executed.", "db > "]
+
+    # 哈希表没有 key 的顺序
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    output = run_sql_commands(dbname, ["insert 1 a b", "select order by id desc", ".exit"], ["--hash"])
+    assert output == ["db > Executed.", "db > Error: Hash tables have no key order.", "db > "]
+
+
+@log_func
+@db_context_manage
+def test_legacy_leaf_format(dbname):
+    """加 prev 指针之前的文件: 第 0 页没有格式标记, 叶子头 14 字节; 打开时改写叶子并补上 prev 指针"""
+    rows = [f"{i} user{i} person{i}@example.com" for i in range(1, 41)]
+    run_sql_commands(dbname, [f"insert {i} user{i} person{i}@example.com" for i in range(40, 0, -1)] + [".exit"])
+    with open(dbname, "rb") as f:
+        data = bytearray(f.read())
+    assert data[2:6] == b"LNK2"
+    # 降回旧格式: 去掉标记 (根的 parent 指针), 每个叶子的单元前移 4 字节, 不留 prev 指针
+    data[2:6] = bytes(4)
+    for base in range(0, len(data), 4096):
+        if data[base] == 0:
+            data[base + 14:base + 4092] = data[base + 18:base + 4096]
+            data[base + 4092:base + 4096] = bytes(4)
+    with open(dbname, "wb") as f:
+        f.write(data)
+
+    # 上次会话留下的 .warm 还在: 预读的旧页不能盖掉已经改写的叶子
+    assert os.path.exists(dbname + ".warm")
+    output = run_sql_commands(dbname, ["select", "select order by id desc", "insert 41 user41 person41@example.com",
+                                       ".exit"])
+    assert output == ["db > " + rows[0]] + rows[1:] + ["Executed."] + \
+           ["db > " + rows[-1]] + rows[-2::-1] + ["Executed.", "db > Executed.", "db > "]
+    # 改写过的文件带着标记, 再打开不再转换
+    rows.append("41 user41 person41@example.com")
+    with open(dbname, "rb") as f:
+        assert f.read(6)[2:] == b"LNK2"
+    output = run_sql_commands(dbname, ["select", "select order by id desc limit 2", ".exit"])
+    assert output == ["db > " + rows[0]] + rows[1:] + ["Executed.", "db > " + rows[-1], rows[-2], "Executed.", "db > "]
+
+    # 没有 .warm 时同样改写
+    remove_warm_set(dbname)
+    with open(dbname, "wb") as f:
+        f.write(data)
+    output = run_sql_commands(dbname, ["select order by id desc", ".exit"])
+    assert output == ["db > " + rows[-2]] + rows[-3::-1] + ["Executed.", "db > "]
+
+    # 两种格式都不是的文件不打开: 没有标记, 根的第一个孩子越界
+    remove_warm_set(dbname)
+    data[0:4096] = bytes(4096)
+    data[0] = 1
+    data[6:10] = (1).to_bytes(4, "little")
+    data[18:22] = (999).to_bytes(4, "little")
+    with open(dbname, "wb") as f:
+        f.write(data)
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    assert output == ["Unable to open file"]
+
+
+@log_func
+@db_context_manage
+def test_string_filter(dbname):
+    """where username / email 在扫描时直接比较页里的字段字节, 只有匹配的行才反序列化输出"""
+    domains = ["example.com", "corp.com"]
+    commands = [f"insert {i} user{i} person{i}@{domains[i % 2]}" for i in range(1, 31)]
+    commands += [
+        "select where username = 'user7'",
+        "select where username = 'user'",
+        "select where username like 'user1%' limit 3",
+        "select where username like 'user2%' order by id desc limit 2",
+        "select where email like '%@corp.com' limit 4",
+        "select where email like '%son3%'",
+        "select where username like 'us%er'",
+        "select where username = user7",
+        "select where phone = '1'",
+        ".exit",
+    ]
+    output = run_sql_commands(dbname, commands)
+    row = lambda i: f"{i} user{i} person{i}@{domains[i % 2]}"
+    assert output[30:] == [
+        "db > " + row(7), "Executed.",
+        "db > Executed.",
+        "db > " + row(1), row(10), row(11), "Executed.",
+        "db > " + row(29), row(28), "Executed.",
+        "db > " + row(1), row(3), row(5), row(7), "Executed.",
+        "db > " + row(3), row(30), "Executed.",
+        "db > Syntax error. Could not parse statement.",
+        "db > Syntax error. Could not parse statement.",
+        "db > Syntax error. Could not parse statement.",
+        "db > ",
+    ]
+
+    # 建表后的记录不是 users 的布局
+    os.remove(dbname)
+    remove_warm_set(dbname)
+    output = run_sql_commands(dbname, ["create table t (id int32, name char(8))", "insert 1 a",
+                                       "select where username = 'a'", "select where name = a", ".exit"])
+    assert output[-4:] == ["db > Error: Only users rows have username and email columns.", "db > 1 a", "Executed.",
+                           "db > "]
+
+
+@log_func
+@db_context_manage
+def test_concurrent_insert_and_select(dbname, num_shards: int = 0):
+    """多个线程通过 libsimple_db.so 同时插入和查询: ctypes 调用时释放 GIL, 所以锁存器协议真的会被并发执行
+    :param num_shards: 大于 0 时分片, 插入在调用线程里直接写进所属分片
+    """
+    lib = ctypes.CDLL("./libsimple_db.so")
+    lib.simple_db_bind_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_int64]
+    lib.simple_db_bind_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p]
+    lib.simple_db_step.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+    for name in ["simple_db_reset", "simple_db_finalize", "simple_db_close"]:
+        getattr(lib, name).argtypes = [ctypes.c_void_p]
+    ok, row_ready, done = 0, 1, 2
+    db = ctypes.c_void_p()
+    assert lib.simple_db_open(dbname.encode(), num_shards << 8, ctypes.byref(db)) == ok
+
+    writers, rows = 4, 400
+    keys = [(i * 151) % rows + 1 for i in range(rows)]
+    errors = []
+    writers_done = threading.Event()
+
+    def writer(first: int):
+        stmt = ctypes.c_void_p()
+        assert lib.simple_db_prepare(db, b"insert ? ? ?", ctypes.byref(stmt)) == ok
+        row = ctypes.POINTER(Row)()
+        for key in keys[first::writers]:
+            lib.simple_db_reset(stmt)
+            lib.simple_db_bind_int(stmt, 1, key)
+            lib.simple_db_bind_text(stmt, 2, f"user{key}".encode())
+            lib.simple_db_bind_text(stmt, 3, f"person{key}@example.com".encode())
+            result = lib.simple_db_step(stmt, ctypes.byref(row))
+            if result != done:
+                errors.append(("insert", key, result))
+        lib.simple_db_finalize(stmt)
+
+    def reader():
+        # 只会增加行, 每次扫描都按 id 升序, 行数不减少
+        stmt = ctypes.c_void_p()
+        assert lib.simple_db_prepare(db, b"select", ctypes.byref(stmt)) == ok
+        row = ctypes.POINTER(Row)()
+        last_count = 0
+        while not writers_done.is_set():
+            lib.simple_db_reset(stmt)
+            ids = []
+            while lib.simple_db_step(stmt, ctypes.byref(row)) == row_ready:
+                ids.append(row.contents.id)
+                if row.contents.username != f"user{row.contents.id}".encode():
+                    errors.append(("row", row.contents.id))
+            if ids != sorted(set(ids)) or len(ids) < last_count:
+                errors.append(("scan", len(ids), last_count))
+            last_count = len(ids)
+        lib.simple_db_finalize(stmt)
+
+    threads = [threading.Thread(target=writer, args=(i,)) for i in range(writers)]
+    readers = [threading.Thread(target=reader) for _ in range(2)]
+    for thread in threads + readers:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    writers_done.set()
+    for thread in readers:
+        thread.join()
+    assert errors == []
+    assert lib.simple_db_close(db) == ok
+
+    output = run_sql_commands(dbname, ["select", ".exit"])
+    expect = [f"{i} user{i} person{i}@example.com" for i in range(1, rows + 1)]
+    assert output == ["db > " + expect[0]] + expect[1:] + ["Executed.", "db > "]
+    for i in range(num_shards):
+        os.remove(f"{dbname}.{i}")
+        remove_warm_set(f"{dbname}.{i}")
+
+
 if __name__ == "__main__":
     file_name = "./db/test.db"
     test_database_operations(file_name)
-    # test_database_pressure(file_name)
+    test_database_pressure(file_name)
     test_database_long_string(file_name)
     test_database_too_long_string(file_name)
     test_database_persistence(file_name)
@@ -331,3 +1214,24 @@ if __name__ == "__main__":
     test_print_structure_of_one_node_btree(file_name)
     test_print_all_rows_in_a_multi_level_tree(file_name)
     test_print_4_leaf_node_btree(file_name)
+    test_internal_node_split(file_name)
+    test_internal_node_split(file_name, "./simple_db_large", 510, 925000)
+    test_copy_on_write_mode(file_name)
+    test_library_api(file_name)
+    test_sharded_table(file_name)
+    test_stats(file_name)
+    test_timer_and_profile(file_name)
+    test_vacuum(file_name)
+    test_background_flush(file_name)
+    test_warm_start(file_name)
+    test_io_uring(file_name)
+    test_create_table(file_name)
+    test_hash_table(file_name)
+    test_memtable(file_name)
+    test_large_file(file_name)
+    test_corrupt_page_number(file_name)
+    test_order_by_desc(file_name)
+    test_legacy_leaf_format(file_name)
+    test_string_filter(file_name)
+    test_concurrent_insert_and_select(file_name)
+    test_concurrent_insert_and_select(file_name, 4)
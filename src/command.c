@@ -1,10 +1,43 @@
 #include "../inc/command.h"
+#include "../inc/shard.h"
+#include "../inc/profile.h"
+#include "../inc/vacuum.h"
+#include "../inc/hash.h"
+#include "../inc/memtable.h"
 
 
 void indent(uint32_t level);
 
 void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level);
 
+void print_hash(Pager *pager);
+
+void print_stats(const TableStats *stats);
+
+void print_stats_json(const TableStats *stats);
+
+void print_profile();
+
+bool token_is(const char *token, const char *keyword);
+
+PrepareResult prepare_select(InputBuffer *input_buffer, const Schema *schema, Statement *statement);
+
+PrepareResult prepare_string_filter(const char *column, const char *operator, const char *pattern,
+                                    StringFilter *filter);
+
+PrepareResult prepare_record_filter(const Schema *schema, uint32_t column, const char *operator, const char *operand,
+                                    RecordFilter *filter);
+
+PrepareResult prepare_create_table(InputBuffer *input_buffer, Statement *statement);
+
+bool parse_column_type(const char *text, ColumnDef *column);
+
+PrepareResult prepare_record(const Schema *schema, Statement *statement);
+
+void print_record(const Schema *schema, const void *record);
+
+void print_value(const Schema *schema, const void *value);
+
 void print_constants() {
     printf("ROW_SIZE: %d\n", ROW_SIZE);
     printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
@@ -26,6 +59,8 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
 
     switch (get_node_type(node)) {
         case NODE_LEAF:
+            // The caller holds the tree latch shared, which keeps splits out but not inserts
+            pager_latch(pager, page_num, CURSOR_LATCH_SHARED);
             num_keys = *leaf_node_num_cells(node);
             indent(indentation_level);
             printf("- leaf (size %d)\n", num_keys);
@@ -33,6 +68,7 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
                 indent(indentation_level + 1);
                 printf("- %d\n", *leaf_node_key(node, i));
             }
+            pager_unlatch(pager, page_num, CURSOR_LATCH_SHARED);
             break;
         case NODE_INTERNAL:
             // todo
@@ -51,26 +87,179 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
     }
 }
 
+// One entry per bucket, in directory order, with its keys in the order they were inserted
+void print_hash(Pager *pager) {
+    const uint32_t global_depth = hash_global_depth(pager);
+    printf("- directory (global depth %d)\n", global_depth);
+    for (uint32_t index = 0; index < 1u << global_depth; index++) {
+        const uint32_t page_num = hash_bucket_page(pager, index);
+        void *bucket = get_page(pager, page_num);
+        const uint32_t local_depth = *hash_bucket_local_depth(bucket);
+        if (index >> local_depth != 0) {
+            continue;
+        }
+        pager_latch(pager, page_num, CURSOR_LATCH_SHARED);
+        const uint32_t num_cells = *hash_bucket_num_cells(bucket);
+        indent(1);
+        printf("- bucket %d (local depth %d, size %d)\n", index, local_depth, num_cells);
+        for (uint32_t i = 0; i < num_cells; i++) {
+            indent(2);
+            printf("- %d\n", *hash_bucket_key(bucket, i));
+        }
+        pager_unlatch(pager, page_num, CURSOR_LATCH_SHARED);
+    }
+}
+
+void print_stats(const TableStats *stats) {
+    const uint64_t lookups = stats->cache_hits + stats->cache_misses;
+    printf("cache: %llu hits, %llu misses (%.1f%% hit rate)\n", (unsigned long long) stats->cache_hits,
+           (unsigned long long) stats->cache_misses,
+           lookups == 0 ? 0.0 : 100.0 * (double) stats->cache_hits / (double) lookups);
+    printf("reads: %llu pages, %llu bytes\n", (unsigned long long) stats->pages_read,
+           (unsigned long long) stats->bytes_read);
+    printf("writes: %llu pages, %llu bytes\n", (unsigned long long) stats->pages_written,
+           (unsigned long long) stats->bytes_written);
+    printf("splits: %llu leaf, %llu internal\n", (unsigned long long) stats->leaf_splits,
+           (unsigned long long) stats->internal_splits);
+    printf("tree: height %d, %d leaf pages, %d internal pages, %d pages in file\n", stats->tree_height,
+           stats->leaf_pages, stats->internal_pages, stats->num_pages);
+    printf("rows: %llu, leaf fill %.1f%%\n", (unsigned long long) stats->rows, 100.0 * stats->leaf_fill);
+    if (stats->memtable_rows > 0) {
+        printf("memtable: %llu rows\n", (unsigned long long) stats->memtable_rows);
+    }
+}
+
+void print_stats_json(const TableStats *stats) {
+    printf("{\"cache_hits\":%llu,\"cache_misses\":%llu,\"pages_read\":%llu,\"bytes_read\":%llu,"
+           "\"pages_written\":%llu,\"bytes_written\":%llu,\"leaf_splits\":%llu,\"internal_splits\":%llu,"
+           "\"tree_height\":%u,\"num_pages\":%u,\"leaf_pages\":%u,\"internal_pages\":%u,\"rows\":%llu,"
+           "\"leaf_fill\":%.4f,\"memtable_rows\":%llu}\n",
+           (unsigned long long) stats->cache_hits, (unsigned long long) stats->cache_misses,
+           (unsigned long long) stats->pages_read, (unsigned long long) stats->bytes_read,
+           (unsigned long long) stats->pages_written, (unsigned long long) stats->bytes_written,
+           (unsigned long long) stats->leaf_splits, (unsigned long long) stats->internal_splits,
+           stats->tree_height, stats->num_pages, stats->leaf_pages, stats->internal_pages,
+           (unsigned long long) stats->rows, stats->leaf_fill, (unsigned long long) stats->memtable_rows);
+}
+
+void print_profile() {
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "point", "count", "mean_us", "p50_us", "p99_us",
+           "p999_us", "max_us");
+    for (uint32_t i = 0; i < PROFILE_POINT_COUNT; i++) {
+        ProfileSummary summary;
+        profile_summary((ProfilePoint) i, &summary);
+        printf("%-12s %10llu %10.3f %10.3f %10.3f %10.3f %10.3f\n", PROFILE_POINT_NAMES[i],
+               (unsigned long long) summary.count, summary.mean_ns / 1e3, summary.p50_ns / 1e3,
+               summary.p99_ns / 1e3, summary.p999_ns / 1e3, summary.max_ns / 1e3);
+    }
+}
+
 MetaCommandResult do_meta_command(const InputBuffer *input_buffer, Table *table) {
     if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
+        exit(db_close(table) ? EXIT_SUCCESS : EXIT_FAILURE);
     } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
         printf("Constants: \n");
         print_constants();
         return META_COMMAND_SUCCESS;
     } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
         printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
+        if (table->shards != NULL) {
+            for (uint32_t i = 0; i < table->shards->num_shards; i++) {
+                Table *shard = table->shards->tables[i];
+                printf("Shard %d:\n", i);
+                pthread_rwlock_rdlock(&shard->tree_latch);
+                if (shard->hash) {
+                    print_hash(shard->pager);
+                } else {
+                    print_tree(shard->pager, shard->root_page_num, 0);
+                }
+                pthread_rwlock_unlock(&shard->tree_latch);
+            }
+            return META_COMMAND_SUCCESS;
+        }
+        pthread_rwlock_rdlock(&table->tree_latch);
+        if (table->hash) {
+            print_hash(table->pager);
+        } else {
+            print_tree(table->pager, table->root_page_num, 0);
+        }
+        pthread_rwlock_unlock(&table->tree_latch);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".schema") == 0) {
+        const Schema *schema = table->catalog->schema;
+        if (schema == NULL) {
+            printf("create table users (id int32, username char(%d), email char(%d))\n", COLUMN_USERNAME_SIZE,
+                   COLUMN_EMAIL_SIZE);
+        } else {
+            char line[SCHEMA_LINE_SIZE];
+            schema_describe(schema, line);
+            printf("%s\n", line);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+        TableStats stats;
+        table_stats(table, &stats);
+        print_stats(&stats);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".stats json") == 0) {
+        TableStats stats;
+        table_stats(table, &stats);
+        print_stats_json(&stats);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".timer on") == 0 || strcmp(input_buffer->buffer, ".timer off") == 0) {
+        profile_set_timer(strcmp(input_buffer->buffer, ".timer on") == 0);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".profile on") == 0 ||
+               strcmp(input_buffer->buffer, ".profile off") == 0) {
+        profile_enable(strcmp(input_buffer->buffer, ".profile on") == 0);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".profile") == 0) {
+        print_profile();
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".vacuum") == 0 || strncmp(input_buffer->buffer, ".vacuum ", 8) == 0) {
+        long fill_percent = VACUUM_DEFAULT_FILL;
+        if (input_buffer->buffer[7] != '\0') {
+            fill_percent = strtol(input_buffer->buffer + 8, NULL, 10);
+        }
+        if (fill_percent < 1 || fill_percent > 100) {
+            printf("Fill factor must be between 1 and 100\n");
+            return META_COMMAND_SUCCESS;
+        }
+        switch (table_vacuum(table, (uint32_t) fill_percent)) {
+            case VACUUM_SUCCESS:
+                break;
+            case VACUUM_HASH_TABLE:
+                printf("Error: Hash tables have no key order.\n");
+                break;
+            case VACUUM_SNAPSHOT_OPEN:
+                printf("Error: A snapshot is open.\n");
+                break;
+            case VACUUM_TOO_LARGE:
+                printf("Error: Vacuumed table would not fit in %d pages.\n", TABLE_MAX_PAGES);
+                break;
+            case VACUUM_IO_ERROR:
+                printf("Error: Vacuum failed.\n");
+                break;
+        }
         return META_COMMAND_SUCCESS;
     } else {
         return META_COMMAND_UNRECOGNIZED_COMMAND;
     }
 }
 
-PrepareResult prepare_insert(const InputBuffer *input_buffer, Statement *statement) {
+bool is_param(const char *token) {
+    return strcmp(token, "?") == 0;
+}
+
+PrepareResult prepare_insert(const InputBuffer *input_buffer, const Table *table, Statement *statement) {
     statement->type = STATEMENT_INSERT;
+    statement->num_params = 0;
+    statement->has_record = false;
+    memset(&statement->row_to_insert, 0, sizeof(Row));
     char *keyword = strtok(input_buffer->buffer, " ");
+    if (table->catalog->schema != NULL) {
+        return prepare_record(table->catalog->schema, statement);
+    }
     char *id_string = strtok(NULL, " ");
     char *username = strtok(NULL, " ");
     char *email = strtok(NULL, " ");
@@ -81,54 +270,359 @@ PrepareResult prepare_insert(const InputBuffer *input_buffer, Statement *stateme
     if (id_string == NULL || username == NULL || email == NULL) {
         return PREPARE_SYNTAX_ERROR;
     }
-    long id = strtol(id_string, NULL, 10);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
+    if (is_param(id_string)) {
+        statement->params[statement->num_params++] = COLUMN_ID;
+    } else {
+        long id = strtol(id_string, NULL, 10);
+        if (id < 0) {
+            return PREPARE_NEGATIVE_ID;
+        }
+        statement->row_to_insert.id = (uint32_t) id;
     }
 
     // check validity of username
-    if (strlen(username) > COLUMN_USERNAME_SIZE) {
+    if (is_param(username)) {
+        statement->params[statement->num_params++] = COLUMN_USERNAME;
+    } else if (strlen(username) > COLUMN_USERNAME_SIZE) {
         return PREPARE_STRING_TOO_LONG;
+    } else {
+        strcpy(statement->row_to_insert.username, username);
     }
 
     // check validity of email
-    if (strlen(email) > COLUMN_EMAIL_SIZE) {
+    if (is_param(email)) {
+        statement->params[statement->num_params++] = COLUMN_EMAIL;
+    } else if (strlen(email) > COLUMN_EMAIL_SIZE) {
         return PREPARE_STRING_TOO_LONG;
+    } else {
+        strcpy(statement->row_to_insert.email, email);
     }
 
-    statement->row_to_insert.id = (uint32_t) id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
+    return PREPARE_SUCCESS;
+}
+
+// The values after "insert", already split off by strtok, one per column
+PrepareResult prepare_record(const Schema *schema, Statement *statement) {
+    char *values[SCHEMA_MAX_COLUMNS];
+    uint32_t num_values = 0;
+    for (char *value = strtok(NULL, " "); value != NULL; value = strtok(NULL, " ")) {
+        if (num_values == schema->num_columns) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (is_param(value)) {
+            // Left zeroed for the codec to fill in at bind time
+            statement->record_params[statement->num_params++] = num_values;
+            value = NULL;
+        }
+        values[num_values++] = value;
+    }
+    if (num_values < schema->num_columns) {
+        return PREPARE_SYNTAX_ERROR;
+    }
 
+    uint32_t key;
+    switch (schema_encode(schema, values, statement->record, &key)) {
+        case CODEC_OK:
+            break;
+        case CODEC_INVALID:
+            return PREPARE_SYNTAX_ERROR;
+        case CODEC_TOO_LONG:
+            return PREPARE_STRING_TOO_LONG;
+    }
+    if ((int32_t) key < 0) {
+        return PREPARE_NEGATIVE_ID;
+    }
+    statement->row_to_insert.id = key;
+    statement->has_record = true;
     return PREPARE_SUCCESS;
 }
 
-PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement) {
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
+// true if token is the given keyword; a missing token matches nothing
+bool token_is(const char *token, const char *keyword) {
+    return token != NULL && strcmp(token, keyword) == 0;
+}
+
+// select [where id = {id} | where {username|email} {=|like} '{text}' | where {column} {=|<|>} {value}]
+//     [order by id [asc|desc]] [limit {n}]
+PrepareResult prepare_select(InputBuffer *input_buffer, const Schema *schema, Statement *statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->num_params = 0;
+    statement->has_where_id = false;
+    statement->has_filter = false;
+    statement->has_record_filter = false;
+    statement->order_desc = false;
+    statement->limit = UINT32_MAX;
+    strtok(input_buffer->buffer, " ");
+    char *token = strtok(NULL, " ");
+
+    if (token_is(token, "where")) {
+        char *column = strtok(NULL, " ");
+        char *operator = strtok(NULL, " ");
+        char *operand = strtok(NULL, " ");
+        const uint32_t index = schema == NULL || column == NULL ? 0 : schema_find_column(schema, column);
+        const bool record_column = schema != NULL && column != NULL && index < schema->num_columns;
+        // The key is looked up, by its own name or as id; every other column is scanned for
+        if ((record_column && index == 0 && token_is(operator, "=")) || (!record_column && token_is(column, "id"))) {
+            if (!token_is(operator, "=") || operand == NULL) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            char *end;
+            const long id = strtol(operand, &end, 10);
+            if (*end != '\0' || id > UINT32_MAX) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if (id < 0) {
+                return PREPARE_NEGATIVE_ID;
+            }
+            statement->has_where_id = true;
+            statement->where_id = (uint32_t) id;
+        } else if (record_column) {
+            const PrepareResult result = prepare_record_filter(schema, index, operator, operand,
+                                                               &statement->record_filter);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+            statement->has_record_filter = true;
+        } else {
+            const PrepareResult result = prepare_string_filter(column, operator, operand, &statement->filter);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+            statement->has_filter = true;
+        }
+        token = strtok(NULL, " ");
+    }
+
+    if (token_is(token, "order")) {
+        if (!token_is(strtok(NULL, " "), "by") || !token_is(strtok(NULL, " "), "id")) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+        if (token_is(token, "asc") || token_is(token, "desc")) {
+            statement->order_desc = token_is(token, "desc");
+            token = strtok(NULL, " ");
+        }
+    }
+
+    if (token_is(token, "limit")) {
+        char *limit_string = strtok(NULL, " ");
+        if (limit_string == NULL || limit_string[0] == '-') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        char *end;
+        const unsigned long limit = strtoul(limit_string, &end, 10);
+        if (end == limit_string || *end != '\0' || limit > UINT32_MAX) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->limit = (uint32_t) limit;
+        token = strtok(NULL, " ");
+    }
+
+    return token == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+// {username|email} = '{text}', or like with a leading and / or trailing %
+PrepareResult prepare_string_filter(const char *column, const char *operator, const char *pattern,
+                                    StringFilter *filter) {
+    if (token_is(column, "username")) {
+        filter->offset = USERNAME_OFFSET;
+        filter->size = USERNAME_SIZE;
+    } else if (token_is(column, "email")) {
+        filter->offset = EMAIL_OFFSET;
+        filter->size = EMAIL_SIZE;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    const bool like = token_is(operator, "like");
+    if (!like && !token_is(operator, "=")) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    size_t length = pattern == NULL ? 0 : strlen(pattern);
+    if (length < 2 || pattern[0] != '\'' || pattern[length - 1] != '\'') {
+        return PREPARE_SYNTAX_ERROR;
     }
-    if (strncmp(input_buffer->buffer, "select", 6) == 0) {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+    pattern++;
+    length -= 2;
+
+    bool leading = false, trailing = false;
+    if (like && length > 0 && pattern[0] == '%') {
+        leading = true;
+        pattern++;
+        length--;
+    }
+    if (like && length > 0 && pattern[length - 1] == '%') {
+        trailing = true;
+        length--;
+    }
+    if (like && memchr(pattern, '%', length) != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    // A longer text matches nothing, and the kernels may compare length + 1 bytes of the field
+    if (length >= filter->size) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    filter->kind = leading ? (trailing ? MATCH_CONTAINS : MATCH_SUFFIX) : (trailing ? MATCH_PREFIX : MATCH_EXACT);
+    filter->length = (uint32_t) length;
+    memcpy(filter->text, pattern, length);
+    filter->text[length] = '\0';
+    return PREPARE_SUCCESS;
+}
+
+// {column} {=|<|>} {value}, the value written as in an insert
+PrepareResult prepare_record_filter(const Schema *schema, uint32_t column, const char *operator, const char *operand,
+                                    RecordFilter *filter) {
+    if (token_is(operator, "=")) {
+        filter->sign = 0;
+    } else if (token_is(operator, "<")) {
+        filter->sign = -1;
+    } else if (token_is(operator, ">")) {
+        filter->sign = 1;
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (operand == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    filter->codec = schema->codecs[column];
+    memset(filter->slot, 0, sizeof(filter->slot));
+    switch (filter->codec.encode(operand, filter->slot, filter->codec.length)) {
+        case CODEC_OK:
+            return PREPARE_SUCCESS;
+        case CODEC_INVALID:
+            return PREPARE_SYNTAX_ERROR;
+        case CODEC_TOO_LONG:
+            return PREPARE_STRING_TOO_LONG;
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+// create table {name} ({column} {type}, ...)
+PrepareResult prepare_create_table(InputBuffer *input_buffer, Statement *statement) {
+    statement->type = STATEMENT_CREATE_TABLE;
+    statement->num_params = 0;
+    Schema *schema = &statement->schema;
+    memset(schema, 0, sizeof(Schema));
+
+    char *open = strchr(input_buffer->buffer, '(');
+    char *close = strrchr(input_buffer->buffer, ')');
+    if (open == NULL || close == NULL || close < open || close[1] != '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *open = '\0';
+    *close = '\0';
+    char *keyword = strtok(input_buffer->buffer, " ");
+    char *table_keyword = strtok(NULL, " ");
+    char *table_name = strtok(NULL, " ");
+    if (strcmp(keyword, "create") != 0 || table_keyword == NULL || strcmp(table_keyword, "table") != 0 ||
+        table_name == NULL || strtok(NULL, " ") != NULL || strlen(table_name) >= SCHEMA_NAME_SIZE) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    strcpy(schema->table_name, table_name);
+
+    char *columns_end;
+    for (char *definition = strtok_r(open + 1, ",", &columns_end); definition != NULL;
+         definition = strtok_r(NULL, ",", &columns_end)) {
+        char *definition_end;
+        char *name = strtok_r(definition, " ", &definition_end);
+        char *type = strtok_r(NULL, " ", &definition_end);
+        if (schema->num_columns == SCHEMA_MAX_COLUMNS || name == NULL || type == NULL ||
+            strtok_r(NULL, " ", &definition_end) != NULL || strlen(name) >= SCHEMA_NAME_SIZE) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        ColumnDef *column = &schema->columns[schema->num_columns++];
+        strcpy(column->name, name);
+        if (!parse_column_type(type, column)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+
+    if (!schema_compile(schema)) {
+        return schema->record_size > SCHEMA_RECORD_MAX_SIZE ? PREPARE_ROW_TOO_WIDE : PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// int32, int64, double, char(n) or varchar(n)
+bool parse_column_type(const char *text, ColumnDef *column) {
+    const ColumnType numbers[] = {COLUMN_TYPE_INT32, COLUMN_TYPE_INT64, COLUMN_TYPE_DOUBLE};
+    const char *number_names[] = {"int32", "int64", "double"};
+    for (uint32_t i = 0; i < 3; i++) {
+        if (strcmp(text, number_names[i]) == 0) {
+            column->type = numbers[i];
+            column->length = 0;
+            return true;
+        }
     }
 
-    return PREPARE_UNRECOGNIZED_STATEMENT;
+    const char *open = strchr(text, '(');
+    if (open == NULL) {
+        return false;
+    }
+    if (open - text == 4 && strncmp(text, "char", 4) == 0) {
+        column->type = COLUMN_TYPE_CHAR;
+    } else if (open - text == 7 && strncmp(text, "varchar", 7) == 0) {
+        column->type = COLUMN_TYPE_VARCHAR;
+    } else {
+        return false;
+    }
+    char *end;
+    const unsigned long length = strtoul(open + 1, &end, 10);
+    if (end == open + 1 || strcmp(end, ")") != 0 || length == 0) {
+        return false;
+    }
+    // schema_compile rejects anything that does not fit in a record
+    column->length = length > UINT32_MAX ? UINT32_MAX : (uint32_t) length;
+    return true;
+}
+
+PrepareResult prepare_statement(InputBuffer *input_buffer, const Table *table, Statement *statement) {
+    const uint64_t start = profile_start();
+    PrepareResult result = PREPARE_UNRECOGNIZED_STATEMENT;
+    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
+        result = prepare_insert(input_buffer, table, statement);
+    } else if (strncmp(input_buffer->buffer, "select", 6) == 0) {
+        result = prepare_select(input_buffer, table->catalog->schema, statement);
+    } else if (strncmp(input_buffer->buffer, "create", 6) == 0) {
+        result = prepare_create_table(input_buffer, statement);
+    }
+    profile_record(PROFILE_PREPARE, start);
+    return result;
 }
 
 ExecuteResult execute_insert(const Statement *statement, Table *table) {
+    if (table->shards != NULL) {
+        return shard_execute_insert(statement, table);
+    }
+    if (table->memtable != NULL) {
+        return memtable_execute_insert(statement, table);
+    }
+    return tree_execute_insert(statement, table);
+}
+
+ExecuteResult tree_execute_insert(const Statement *statement, Table *table) {
     const Row *row_to_insert = &(statement->row_to_insert);
     const uint32_t key_to_insert = row_to_insert->id;
-    const Cursor *cursor = table_find(table, key_to_insert);
+    Cursor cursor;
+    table_find_for_insert(table, key_to_insert, &cursor);
 
-    void *insert_node = get_page(table->pager, cursor->page_num);
-    if (cursor->cell_num < *leaf_node_num_cells(insert_node)) {
-        const uint32_t key_at_index = *leaf_node_key(insert_node, cursor->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPLICATE_KEY;
-        }
+    if (cursor_holds_key(&cursor, key_to_insert)) {
+        cursor_close(&cursor);
+        return EXECUTE_DUPLICATE_KEY;
     }
 
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
+    if (!table_can_insert(&cursor, key_to_insert)) {
+        cursor_close(&cursor);
+        return EXECUTE_TABLE_FULL;
+    }
+
+    if (statement->has_record) {
+        leaf_node_insert(&cursor, row_to_insert->id, statement->record);
+    } else {
+        uint8_t record[SCHEMA_RECORD_MAX_SIZE];
+        serialize_row(row_to_insert, record);
+        leaf_node_insert(&cursor, row_to_insert->id, record);
+    }
+    cursor_close(&cursor);
 
     return EXECUTE_SUCCESS;
 }
@@ -136,26 +630,148 @@ ExecuteResult execute_insert(const Statement *statement, Table *table) {
 ExecuteResult execute_select(const Statement *statement, Table *table) {
     assert(statement->type == STATEMENT_SELECT);
 
-    Cursor *cursor = table_start(table);
-    Row row;
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+    const Schema *schema = table->catalog->schema;
+    if (statement->has_where_id) {
+        // A single descent, or a single bucket in a hash table
+        Cursor cursor;
+        table_find(table, statement->where_id, &cursor);
+        if (cursor_holds_key(&cursor, statement->where_id) && statement->limit > 0) {
+            print_value(schema, cursor_value(&cursor));
+        }
+        cursor_close(&cursor);
+        return EXECUTE_SUCCESS;
+    }
+    if (statement->order_desc && table->hash) {
+        return EXECUTE_UNORDERED;
+    }
+    if (statement->has_filter && schema != NULL) {
+        return EXECUTE_SCHEMA;
     }
-    free(cursor);
+
+    // A limit stops the scan early, so order by id desc limit {n} reads only the last n rows
+    Cursor cursor;
+    if (statement->order_desc) {
+        table_end(table, &cursor);
+    } else {
+        table_start(table, &cursor);
+    }
+    uint32_t printed = 0;
+    while (!(cursor.end_of_table) && printed < statement->limit) {
+        // Rows are filtered in the page, so only the matching ones are deserialized and printed
+        const void *value = cursor_value(&cursor);
+        if (statement_matches(statement, value)) {
+            print_value(schema, value);
+            printed++;
+        }
+        if (statement->order_desc) {
+            cursor_retreat(&cursor);
+        } else {
+            cursor_advance(&cursor);
+        }
+    }
+    cursor_close(&cursor);
     return EXECUTE_SUCCESS;
 }
 
+bool record_filter_matches(const RecordFilter *filter, const void *value) {
+    const int order = filter->codec.compare((const uint8_t *) value + filter->codec.offset, filter->slot,
+                                            filter->codec.length);
+    return (order > 0) - (order < 0) == filter->sign;
+}
+
+bool statement_matches(const Statement *statement, const void *value) {
+    if (statement->has_filter) {
+        return string_filter_matches(&statement->filter, value);
+    }
+    if (statement->has_record_filter) {
+        return record_filter_matches(&statement->record_filter, value);
+    }
+    return true;
+}
+
+bool string_filter_matches(const StringFilter *filter, const void *value) {
+    const char *field = (const char *) value + filter->offset;
+    switch (filter->kind) {
+        case MATCH_EXACT:
+            // The text's NUL has to line up with the field's
+            return memcmp(field, filter->text, filter->length + 1) == 0;
+        case MATCH_PREFIX:
+            // The text holds no NUL, so equal bytes also mean the field is at least this long
+            return memcmp(field, filter->text, filter->length) == 0;
+        case MATCH_SUFFIX:
+        case MATCH_CONTAINS:
+            break;
+    }
+    const char *end = memchr(field, '\0', filter->size);
+    const size_t length = end == NULL ? filter->size : (size_t) (end - field);
+    if (length < filter->length) {
+        return false;
+    }
+    if (filter->kind == MATCH_SUFFIX) {
+        return memcmp(field + length - filter->length, filter->text, filter->length) == 0;
+    }
+    return memmem(field, length, filter->text, filter->length) != NULL;
+}
+
+ExecuteResult execute_create_table(const Statement *statement, Table *table) {
+    assert(statement->type == STATEMENT_CREATE_TABLE);
+    if (table->catalog->schema != NULL) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+    // Rows already stored have the users layout
+    TableStats stats;
+    table_stats(table, &stats);
+    if (stats.rows + stats.memtable_rows > 0) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+    return catalog_create(table->catalog, &statement->schema) ? EXECUTE_SUCCESS : EXECUTE_IO_ERROR;
+}
+
 void print_row(Row *row) {
+    const uint64_t start = profile_start();
     printf("%d %s %s\n", row->id, row->username, row->email);
+    profile_record(PROFILE_PRINT_ROW, start);
+}
+
+void print_record(const Schema *schema, const void *record) {
+    const uint64_t start = profile_start();
+    char line[SCHEMA_LINE_SIZE];
+    schema_format(schema, record, line);
+    printf("%s\n", line);
+    profile_record(PROFILE_PRINT_ROW, start);
+}
+
+// A created table's record, or else a users row
+void print_value(const Schema *schema, const void *value) {
+    if (schema != NULL) {
+        print_record(schema, value);
+    } else {
+        Row row;
+        deserialize_row(value, &row);
+        print_row(&row);
+    }
 }
 
 ExecuteResult execute_statement(Statement *statement, Table *table) {
+    // A failed pager may have handed out the scratch leaf instead of a page, so nothing it did is trusted
+    if (table_io_error(table) != 0) {
+        return EXECUTE_IO_ERROR;
+    }
+    // Timed here rather than in execute_insert, which sharded inserts re-enter
+    const uint64_t start = profile_start();
+    ExecuteResult result = EXECUTE_SUCCESS;
     switch (statement->type) {
         case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
+            result = execute_insert(statement, table);
+            profile_record(PROFILE_INSERT, start);
+            break;
         case (STATEMENT_SELECT):
-            return execute_select(statement, table);
+            result = execute_select(statement, table);
+            profile_record(PROFILE_SELECT, start);
+            break;
+        case (STATEMENT_CREATE_TABLE):
+            result = execute_create_table(statement, table);
+            break;
     }
+    return result == EXECUTE_SUCCESS && table_io_error(table) != 0 ? EXECUTE_IO_ERROR : result;
 }
@@ -0,0 +1,144 @@
+#include "../inc/flusher.h"
+#include <time.h>
+
+void *flusher_main(void *arg);
+
+uint32_t flusher_collect(Flusher *flusher);
+
+void flusher_write(Flusher *flusher, uint32_t count);
+
+void flusher_start(Table *table) {
+    Flusher *flusher = malloc(sizeof(Flusher));
+    flusher->table = table;
+    flusher->stopping = false;
+    flusher->buffer = malloc((size_t) FLUSHER_BATCH_PAGES * PAGE_SIZE);
+    pthread_mutex_init(&flusher->lock, NULL);
+    pthread_cond_init(&flusher->wake, NULL);
+    flusher->io = io_open(table->pager->file_descriptor, table->pager->io->kind);
+    io_register_buffer(flusher->io, flusher->buffer, (size_t) FLUSHER_BATCH_PAGES * PAGE_SIZE);
+    table->flusher = flusher;
+    pthread_create(&flusher->thread, NULL, flusher_main, flusher);
+}
+
+void flusher_stop(Table *table) {
+    Flusher *flusher = table->flusher;
+    if (flusher == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&flusher->lock);
+    flusher->stopping = true;
+    pthread_cond_signal(&flusher->wake);
+    pthread_mutex_unlock(&flusher->lock);
+    pthread_join(flusher->thread, NULL);
+
+    pthread_cond_destroy(&flusher->wake);
+    pthread_mutex_destroy(&flusher->lock);
+    io_close(flusher->io);
+    free(flusher->buffer);
+    free(flusher);
+    table->flusher = NULL;
+}
+
+void *flusher_main(void *arg) {
+    Flusher *flusher = arg;
+    pthread_mutex_lock(&flusher->lock);
+    while (!flusher->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long) FLUSHER_INTERVAL_MS * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (!flusher->stopping &&
+               pthread_cond_timedwait(&flusher->wake, &flusher->lock, &deadline) != ETIMEDOUT) {
+        }
+        if (flusher->stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&flusher->lock);
+
+        const uint32_t count = flusher_collect(flusher);
+        flusher_write(flusher, count);
+
+        pthread_mutex_lock(&flusher->lock);
+    }
+    pthread_mutex_unlock(&flusher->lock);
+    return NULL;
+}
+
+/*
+ * Copies up to FLUSHER_BATCH_PAGES cold dirty pages into the buffer, lowest page number first.
+ * A page is marked clean when it is copied, so a write that lands after the copy dirties it again.
+ */
+uint32_t flusher_collect(Flusher *flusher) {
+    Table *table = flusher->table;
+    Pager *pager = table->pager;
+    // Pages written from here on are hot until the next pass
+    const uint32_t epoch = atomic_fetch_add(&pager->flush_epoch, 1);
+
+    // Writers modify pages under the copy-on-write writer lock, or else under the tree latch
+    // (exclusive) or the tree latch (shared) plus the page's frame latch (exclusive)
+    if (table->cow != NULL) {
+        pthread_mutex_lock(&table->cow->writer_lock);
+    } else {
+        pthread_rwlock_rdlock(&table->tree_latch);
+    }
+    pthread_mutex_lock(&pager->lock);
+    const uint32_t num_pages = pager->num_pages;
+    pthread_mutex_unlock(&pager->lock);
+
+    uint32_t count = 0;
+    for (uint32_t page_num = 0; page_num < num_pages && count < FLUSHER_BATCH_PAGES; page_num++) {
+        const uint32_t dirty = atomic_load(&pager->dirty[page_num]);
+        if (dirty == 0 || dirty >= epoch) {
+            continue;
+        }
+        const CursorLatch latch = table->cow != NULL ? CURSOR_LATCH_COW_WRITER : CURSOR_LATCH_SHARED;
+        pager_latch(pager, page_num, latch);
+        memcpy(flusher->buffer + (size_t) count * PAGE_SIZE, get_page(pager, page_num), PAGE_SIZE);
+        atomic_store(&pager->dirty[page_num], 0);
+        pager_unlatch(pager, page_num, latch);
+        flusher->page_nums[count++] = page_num;
+    }
+
+    if (table->cow != NULL) {
+        pthread_mutex_unlock(&table->cow->writer_lock);
+    } else {
+        pthread_rwlock_unlock(&table->tree_latch);
+    }
+    return count;
+}
+
+// Writes each run of consecutive pages as one request; a failed run is marked dirty again
+void flusher_write(Flusher *flusher, uint32_t count) {
+    Pager *pager = flusher->table->pager;
+    struct iovec iov[FLUSHER_BATCH_PAGES];
+    IoRequest requests[FLUSHER_BATCH_PAGES];
+    uint32_t run_starts[FLUSHER_BATCH_PAGES];
+    uint32_t num_requests = 0;
+    uint32_t run_start = 0;
+    for (uint32_t i = 1; i <= count; i++) {
+        if (i < count && flusher->page_nums[i] == flusher->page_nums[i - 1] + 1) {
+            continue;
+        }
+        iov[num_requests] = (struct iovec) {.iov_base = flusher->buffer + (size_t) run_start * PAGE_SIZE,
+                                            .iov_len = (size_t) (i - run_start) * PAGE_SIZE};
+        requests[num_requests] = (IoRequest) {.iov = &iov[num_requests], .iovcnt = 1,
+                                              .offset = (uint64_t) flusher->page_nums[run_start] * PAGE_SIZE};
+        run_starts[num_requests++] = run_start;
+        run_start = i;
+    }
+
+    io_submit(flusher->io, IO_WRITE, requests, num_requests);
+    for (uint32_t i = 0; i < num_requests; i++) {
+        const uint32_t run_pages = iov[i].iov_len / PAGE_SIZE;
+        if (requests[i].result != (int64_t) iov[i].iov_len) {
+            pager_fail(pager, requests[i].result < 0 ? (int) -requests[i].result : EIO);
+            for (uint32_t j = run_starts[i]; j < run_starts[i] + run_pages; j++) {
+                pager_mark_dirty(pager, flusher->page_nums[j]);
+            }
+        } else {
+            pager_count(&pager->stats.pages_written, run_pages);
+            pager_count(&pager->stats.bytes_written, iov[i].iov_len);
+        }
+    }
+}
@@ -0,0 +1,367 @@
+#include "../inc/hash.h"
+#include "../inc/profile.h"
+
+const char HASH_MAGIC[8] = {'S', 'D', 'B', 'H', 'A', 'S', 'H', '1'};
+// PAGE_SIZE and LEAF_NODE_CELL_SIZE, spelled out so the layout below stays constant expressions
+#define HASH_PAGE_SIZE 4096
+#define HASH_CELL_SIZE \
+    (sizeof(uint32_t) + size_of_attribute(Row, id) + size_of_attribute(Row, username) + size_of_attribute(Row, email))
+
+/*
+ * Header Layout, page 0
+ */
+const uint32_t HASH_GLOBAL_DEPTH_OFFSET = sizeof(HASH_MAGIC);
+const uint32_t HASH_NUM_DIRECTORY_PAGES_OFFSET = HASH_GLOBAL_DEPTH_OFFSET + sizeof(uint32_t);
+const uint32_t HASH_DIRECTORY_PAGES_OFFSET = HASH_NUM_DIRECTORY_PAGES_OFFSET + sizeof(uint32_t);
+
+/*
+ * Directory Layout: nothing but bucket page numbers
+ */
+const uint32_t HASH_DIRECTORY_SLOTS_PER_PAGE = HASH_PAGE_SIZE / sizeof(uint32_t);
+
+/*
+ * Bucket Layout
+ */
+const uint32_t HASH_BUCKET_LOCAL_DEPTH_OFFSET = 0;
+const uint32_t HASH_BUCKET_NUM_CELLS_OFFSET = HASH_BUCKET_LOCAL_DEPTH_OFFSET + sizeof(uint32_t);
+const uint32_t HASH_BUCKET_HEADER_SIZE = HASH_BUCKET_NUM_CELLS_OFFSET + sizeof(uint32_t);
+// Cells are laid out like leaf cells: the key, then ROW_SIZE bytes of value
+const uint32_t HASH_BUCKET_MAX_CELLS = (HASH_PAGE_SIZE - HASH_BUCKET_HEADER_SIZE) / HASH_CELL_SIZE;
+
+uint32_t *hash_header_global_depth(void *header);
+
+uint32_t *hash_header_num_directory_pages(void *header);
+
+uint32_t *hash_header_directory_pages(void *header);
+
+uint32_t hash_directory_pages_for(uint32_t global_depth);
+
+uint32_t hash_slot(Pager *pager, uint32_t hash);
+
+void hash_set_slot(Pager *pager, uint32_t index, uint32_t page_num);
+
+void *hash_bucket_cell(void *bucket, uint32_t cell_num);
+
+void initialize_bucket(void *bucket, uint32_t local_depth);
+
+void hash_double_directory(Pager *pager);
+
+void hash_split_bucket(Pager *pager, uint32_t page_num, uint32_t hash);
+
+void hash_next_bucket(Cursor *cursor);
+
+void hash_init(Pager *pager) {
+    void *header = get_page(pager, 0);
+    memset(header, 0, PAGE_SIZE);
+    memcpy(header, HASH_MAGIC, sizeof(HASH_MAGIC));
+    *hash_header_global_depth(header) = 0;
+    *hash_header_num_directory_pages(header) = 1;
+    hash_header_directory_pages(header)[0] = 1;
+
+    uint32_t *directory = get_page(pager, 1);
+    memset(directory, 0, PAGE_SIZE);
+    directory[0] = 2;
+    initialize_bucket(get_page(pager, 2), 0);
+}
+
+bool hash_file_check(const Pager *pager) {
+    char magic[sizeof(HASH_MAGIC)];
+    return pager->file_length >= PAGE_SIZE &&
+           pread(pager->file_descriptor, magic, sizeof(magic), 0) == (ssize_t) sizeof(magic) &&
+           memcmp(magic, HASH_MAGIC, sizeof(HASH_MAGIC)) == 0;
+}
+
+// murmur3's finalizer: a bijection, so distinct keys always differ in some bit and a split always ends
+uint32_t hash_key(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x85ebca6bu;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35u;
+    key ^= key >> 16;
+    return key;
+}
+
+uint32_t *hash_header_global_depth(void *header) {
+    return header + HASH_GLOBAL_DEPTH_OFFSET;
+}
+
+uint32_t *hash_header_num_directory_pages(void *header) {
+    return header + HASH_NUM_DIRECTORY_PAGES_OFFSET;
+}
+
+uint32_t *hash_header_directory_pages(void *header) {
+    return header + HASH_DIRECTORY_PAGES_OFFSET;
+}
+
+uint32_t hash_directory_pages_for(uint32_t global_depth) {
+    return ((1u << global_depth) + HASH_DIRECTORY_SLOTS_PER_PAGE - 1) / HASH_DIRECTORY_SLOTS_PER_PAGE;
+}
+
+uint32_t hash_global_depth(Pager *pager) {
+    return *hash_header_global_depth(get_page(pager, 0));
+}
+
+uint32_t hash_slot(Pager *pager, uint32_t hash) {
+    return hash & ((1u << hash_global_depth(pager)) - 1);
+}
+
+uint32_t hash_bucket_page(Pager *pager, uint32_t index) {
+    void *header = get_page(pager, 0);
+    const uint32_t directory_page_num = hash_header_directory_pages(header)[index / HASH_DIRECTORY_SLOTS_PER_PAGE];
+    const uint32_t *directory = get_page(pager, directory_page_num);
+    return directory[index % HASH_DIRECTORY_SLOTS_PER_PAGE];
+}
+
+void hash_set_slot(Pager *pager, uint32_t index, uint32_t page_num) {
+    void *header = get_page(pager, 0);
+    const uint32_t directory_page_num = hash_header_directory_pages(header)[index / HASH_DIRECTORY_SLOTS_PER_PAGE];
+    uint32_t *directory = get_page(pager, directory_page_num);
+    directory[index % HASH_DIRECTORY_SLOTS_PER_PAGE] = page_num;
+    pager_mark_dirty(pager, directory_page_num);
+}
+
+uint32_t *hash_bucket_local_depth(void *bucket) {
+    return bucket + HASH_BUCKET_LOCAL_DEPTH_OFFSET;
+}
+
+uint32_t *hash_bucket_num_cells(void *bucket) {
+    return bucket + HASH_BUCKET_NUM_CELLS_OFFSET;
+}
+
+void *hash_bucket_cell(void *bucket, uint32_t cell_num) {
+    return bucket + HASH_BUCKET_HEADER_SIZE + LEAF_NODE_CELL_SIZE * cell_num;
+}
+
+uint32_t *hash_bucket_key(void *bucket, uint32_t cell_num) {
+    return hash_bucket_cell(bucket, cell_num);
+}
+
+void *hash_bucket_value(void *bucket, uint32_t cell_num) {
+    return hash_bucket_cell(bucket, cell_num) + LEAF_NODE_KEY_SIZE;
+}
+
+void initialize_bucket(void *bucket, uint32_t local_depth) {
+    *hash_bucket_local_depth(bucket) = local_depth;
+    *hash_bucket_num_cells(bucket) = 0;
+}
+
+// The caller holds the tree latch
+void hash_find(Table *table, uint32_t key, CursorLatch latch, Cursor *cursor) {
+    Pager *pager = table->pager;
+    const uint32_t index = hash_slot(pager, hash_key(key));
+    const uint32_t page_num = hash_bucket_page(pager, index);
+    pager_latch(pager, page_num, latch);
+    void *bucket = get_page(pager, page_num);
+
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->directory_index = index;
+    cursor->end_of_table = false;
+    cursor->latch = latch;
+    cursor->root_page_num = 0;
+    cursor->shard_cursors = NULL;
+    cursor->merges_memtable = false;
+
+    // Buckets are unsorted and short, so a linear scan
+    const uint32_t num_cells = *hash_bucket_num_cells(bucket);
+    cursor->cell_num = num_cells;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        if (*hash_bucket_key(bucket, i) == key) {
+            cursor->cell_num = i;
+            break;
+        }
+    }
+}
+
+// The caller holds the tree latch shared
+void hash_table_start(Table *table, Cursor *cursor) {
+    Pager *pager = table->pager;
+    const uint32_t page_num = hash_bucket_page(pager, 0);
+    pager_latch(pager, page_num, CURSOR_LATCH_SHARED);
+
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = 0;
+    cursor->directory_index = 0;
+    cursor->end_of_table = false;
+    cursor->latch = CURSOR_LATCH_SHARED;
+    cursor->root_page_num = 0;
+    cursor->shard_cursors = NULL;
+    cursor->merges_memtable = false;
+    if (*hash_bucket_num_cells(get_page(pager, page_num)) == 0) {
+        hash_next_bucket(cursor);
+    }
+}
+
+void hash_cursor_advance(Cursor *cursor) {
+    cursor->cell_num += 1;
+    if (cursor->cell_num >= *hash_bucket_num_cells(get_page(cursor->table->pager, cursor->page_num))) {
+        hash_next_bucket(cursor);
+    }
+}
+
+// Moves to the first row of the next non-empty bucket in directory order
+void hash_next_bucket(Cursor *cursor) {
+    Pager *pager = cursor->table->pager;
+    const uint32_t num_slots = 1u << hash_global_depth(pager);
+    for (uint32_t index = cursor->directory_index + 1; index < num_slots; index++) {
+        const uint32_t page_num = hash_bucket_page(pager, index);
+        void *bucket = get_page(pager, page_num);
+        // Every slot ending in a bucket's local-depth bits points at it; only the lowest one visits it
+        if (index >> *hash_bucket_local_depth(bucket) != 0) {
+            continue;
+        }
+        // Buckets are always latched in directory order, so coupling them cannot deadlock
+        pager_latch(pager, page_num, cursor->latch);
+        if (*hash_bucket_num_cells(bucket) == 0) {
+            pager_unlatch(pager, page_num, cursor->latch);
+            continue;
+        }
+        pager_unlatch(pager, cursor->page_num, cursor->latch);
+        cursor->page_num = page_num;
+        cursor->cell_num = 0;
+        cursor->directory_index = index;
+        return;
+    }
+    cursor->end_of_table = true;
+}
+
+bool hash_can_insert(const Cursor *cursor, uint32_t key) {
+    Pager *pager = cursor->table->pager;
+    void *bucket = get_page(pager, cursor->page_num);
+    const uint32_t num_cells = *hash_bucket_num_cells(bucket);
+    if (num_cells < HASH_BUCKET_MAX_CELLS) {
+        return true;
+    }
+
+    // Split until the half the key goes to has room; the hash is a bijection, so by 32 bits it does
+    const uint32_t hash = hash_key(key);
+    const uint32_t local_depth = *hash_bucket_local_depth(bucket);
+    uint32_t depth = local_depth;
+    uint32_t same_half;
+    do {
+        depth++;
+        const uint32_t mask = (uint32_t) ((1ull << depth) - 1);
+        same_half = 0;
+        for (uint32_t i = 0; i < num_cells; i++) {
+            if (((hash_key(*hash_bucket_key(bucket, i)) ^ hash) & mask) == 0) {
+                same_half++;
+            }
+        }
+    } while (same_half >= HASH_BUCKET_MAX_CELLS);
+    if (depth > HASH_MAX_GLOBAL_DEPTH) {
+        return false;
+    }
+
+    // A page per split, plus the directory pages that doubling up to depth adds
+    uint32_t pages_needed = depth - local_depth;
+    const uint32_t global_depth = hash_global_depth(pager);
+    if (depth > global_depth) {
+        pages_needed += hash_directory_pages_for(depth) - hash_directory_pages_for(global_depth);
+    }
+    return pages_needed <= TABLE_MAX_PAGES - pager->num_pages;
+}
+
+void hash_insert(const Cursor *cursor, uint32_t key, const void *value) {
+    Pager *pager = cursor->table->pager;
+    const uint32_t hash = hash_key(key);
+    uint32_t page_num = cursor->page_num;
+    void *bucket = get_page(pager, page_num);
+    while (*hash_bucket_num_cells(bucket) >= HASH_BUCKET_MAX_CELLS) {
+        // table_find_for_insert only hands out a full bucket with the tree latch held exclusive
+        assert(cursor->latch == CURSOR_LATCH_TREE);
+        const uint64_t start = profile_start();
+        hash_split_bucket(pager, page_num, hash);
+        profile_record(PROFILE_SPLIT, start);
+        page_num = hash_bucket_page(pager, hash_slot(pager, hash));
+        bucket = get_page(pager, page_num);
+    }
+
+    const uint32_t cell_num = *hash_bucket_num_cells(bucket);
+    *hash_bucket_key(bucket, cell_num) = key;
+    memcpy(hash_bucket_value(bucket, cell_num), value, ROW_SIZE);
+    *hash_bucket_num_cells(bucket) = cell_num + 1;
+    pager_mark_dirty(pager, page_num);
+}
+
+// Splits the bucket that hash belongs to on the next bit of the hash
+void hash_split_bucket(Pager *pager, uint32_t page_num, uint32_t hash) {
+    void *old_bucket = get_page(pager, page_num);
+    const uint32_t local_depth = *hash_bucket_local_depth(old_bucket);
+    if (local_depth == hash_global_depth(pager)) {
+        hash_double_directory(pager);
+    }
+    pager_count(&pager->stats.leaf_splits, 1);
+
+    const uint32_t new_page_num = pager->num_pages;
+    void *new_bucket = get_page(pager, new_page_num);
+    initialize_bucket(new_bucket, local_depth + 1);
+    *hash_bucket_local_depth(old_bucket) = local_depth + 1;
+
+    // Cells whose hash has the next bit set move to the new bucket
+    const uint32_t bit = 1u << local_depth;
+    const uint32_t num_cells = *hash_bucket_num_cells(old_bucket);
+    uint32_t kept = 0;
+    uint32_t moved = 0;
+    for (uint32_t i = 0; i < num_cells; i++) {
+        void *cell = hash_bucket_cell(old_bucket, i);
+        if (hash_key(*(uint32_t *) cell) & bit) {
+            memcpy(hash_bucket_cell(new_bucket, moved++), cell, LEAF_NODE_CELL_SIZE);
+        } else {
+            if (kept != i) {
+                memcpy(hash_bucket_cell(old_bucket, kept), cell, LEAF_NODE_CELL_SIZE);
+            }
+            kept++;
+        }
+    }
+    *hash_bucket_num_cells(old_bucket) = kept;
+    *hash_bucket_num_cells(new_bucket) = moved;
+    pager_mark_dirty(pager, page_num);
+    pager_mark_dirty(pager, new_page_num);
+
+    // Every slot ending in the bucket's bits followed by a 1 now belongs to the new bucket
+    const uint32_t num_slots = 1u << hash_global_depth(pager);
+    for (uint32_t index = (hash & (bit - 1)) | bit; index < num_slots; index += bit << 1) {
+        hash_set_slot(pager, index, new_page_num);
+    }
+}
+
+// Slot i + 2^depth starts out pointing wherever slot i does
+void hash_double_directory(Pager *pager) {
+    void *header = get_page(pager, 0);
+    const uint32_t global_depth = *hash_header_global_depth(header);
+    const uint32_t pages_needed = hash_directory_pages_for(global_depth + 1);
+    while (*hash_header_num_directory_pages(header) < pages_needed) {
+        const uint32_t page_num = pager->num_pages;
+        memset(get_page(pager, page_num), 0, PAGE_SIZE);
+        hash_header_directory_pages(header)[(*hash_header_num_directory_pages(header))++] = page_num;
+    }
+
+    const uint32_t num_slots = 1u << global_depth;
+    for (uint32_t i = 0; i < num_slots; i++) {
+        hash_set_slot(pager, num_slots + i, hash_bucket_page(pager, i));
+    }
+    *hash_header_global_depth(header) = global_depth + 1;
+    pager_mark_dirty(pager, 0);
+    pager_count(&pager->stats.internal_splits, 1);
+}
+
+// The caller holds the tree latch shared
+void hash_measure(Table *table, TableStats *stats) {
+    Pager *pager = table->pager;
+    void *header = get_page(pager, 0);
+    const uint32_t global_depth = *hash_header_global_depth(header);
+    stats->tree_height = global_depth;
+    stats->internal_pages = 1 + *hash_header_num_directory_pages(header);
+    for (uint32_t index = 0; index < 1u << global_depth; index++) {
+        const uint32_t page_num = hash_bucket_page(pager, index);
+        void *bucket = get_page(pager, page_num);
+        if (index >> *hash_bucket_local_depth(bucket) == 0) {
+            stats->leaf_pages++;
+            // Inserts that don't split a bucket only hold its frame latch
+            pager_latch(pager, page_num, CURSOR_LATCH_SHARED);
+            stats->rows += *hash_bucket_num_cells(bucket);
+            pager_unlatch(pager, page_num, CURSOR_LATCH_SHARED);
+        }
+    }
+}
@@ -0,0 +1,323 @@
+#include "../inc/io.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#define IO_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define IO_URING_ENTRIES 64
+
+uint64_t io_request_length(const IoRequest *request);
+
+bool io_complete(int fd, IoOp op, IoRequest *request);
+
+bool syscall_submit(IoBackend *io, IoOp op, IoRequest *requests, uint32_t count);
+
+void syscall_close(IoBackend *io);
+
+IoBackend *syscall_open(int fd);
+
+IoBackend *uring_open(int fd);
+
+IoBackend *io_open(int fd, IoKind kind) {
+    if (kind == IO_URING) {
+        IoBackend *io = uring_open(fd);
+        if (io != NULL) {
+            return io;
+        }
+    }
+    return syscall_open(fd);
+}
+
+void io_close(IoBackend *io) {
+    io->close(io);
+}
+
+bool io_submit(IoBackend *io, IoOp op, IoRequest *requests, uint32_t count) {
+    if (count == 0) {
+        return true;
+    }
+    return io->submit(io, op, requests, count);
+}
+
+void io_register_buffer(IoBackend *io, void *buffer, size_t size) {
+    if (io->register_buffer != NULL) {
+        io->register_buffer(io, buffer, size);
+    }
+}
+
+uint64_t io_request_length(const IoRequest *request) {
+    uint64_t length = 0;
+    for (uint32_t i = 0; i < request->iovcnt; i++) {
+        length += request->iov[i].iov_len;
+    }
+    return length;
+}
+
+// Finishes a short transfer one buffer at a time; true if the whole request went through
+bool io_complete(int fd, IoOp op, IoRequest *request) {
+    if (request->result == -EINTR) {
+        request->result = 0;
+    }
+    uint64_t position = 0;
+    for (uint32_t i = 0; i < request->iovcnt && request->result >= 0; i++) {
+        char *base = request->iov[i].iov_base;
+        const uint64_t length = request->iov[i].iov_len;
+        while (request->result >= 0 && (uint64_t) request->result < position + length) {
+            const uint64_t skip = request->result - position;
+            const off_t offset = (off_t) (request->offset + request->result);
+            const ssize_t n = op == IO_READ ? pread(fd, base + skip, length - skip, offset)
+                                            : pwrite(fd, base + skip, length - skip, offset);
+            if (n > 0) {
+                request->result += n;
+            } else if (n == 0) {
+                request->result = -EIO;// End of file in the middle of a page
+            } else if (errno != EINTR) {
+                request->result = -errno;
+            }
+        }
+        position += length;
+    }
+    return request->result >= 0 && (uint64_t) request->result == io_request_length(request);
+}
+
+/*
+ * Syscall backend
+ */
+
+IoBackend *syscall_open(int fd) {
+    IoBackend *io = malloc(sizeof(IoBackend));
+    io->kind = IO_SYSCALL;
+    io->fd = fd;
+    io->submit = syscall_submit;
+    io->register_buffer = NULL;
+    io->close = syscall_close;
+    return io;
+}
+
+bool syscall_submit(IoBackend *io, IoOp op, IoRequest *requests, uint32_t count) {
+    bool success = true;
+    for (uint32_t i = 0; i < count; i++) {
+        IoRequest *request = &requests[i];
+        const ssize_t n = op == IO_READ ? preadv(io->fd, request->iov, (int) request->iovcnt, (off_t) request->offset)
+                                        : pwritev(io->fd, request->iov, (int) request->iovcnt, (off_t) request->offset);
+        request->result = n < 0 ? -errno : n;
+        success &= io_complete(io->fd, op, request);
+    }
+    return success;
+}
+
+void syscall_close(IoBackend *io) {
+    free(io);
+}
+
+/*
+ * io_uring backend, driven through the raw system calls
+ */
+
+#ifdef IO_HAVE_URING
+
+typedef struct {
+    IoBackend base;
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;// Same mapping as sq_ring on kernels with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    uint32_t entries;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    char *fixed_buffer;// Registered as buffer index 0, NULL if none
+    size_t fixed_size;
+    int error;// errno of a failed io_uring_enter; completions may still be queued, so the ring is done
+} IoUring;
+
+bool uring_submit(IoBackend *io, IoOp op, IoRequest *requests, uint32_t count);
+
+void uring_run(IoUring *ring, IoOp op, IoRequest *requests, uint32_t count);
+
+void uring_register_buffer(IoBackend *io, void *buffer, size_t size);
+
+void uring_close(IoBackend *io);
+
+IoBackend *uring_open(int fd) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int ring_fd = (int) syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+    if (ring_fd < 0) {
+        return NULL;
+    }
+
+    IoUring *ring = calloc(1, sizeof(IoUring));
+    ring->ring_fd = ring_fd;
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring
+                                : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       ring_fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        const int error = errno;
+        uring_close(&ring->base);
+        errno = error;
+        return NULL;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    ring->base.kind = IO_URING;
+    ring->base.fd = fd;
+    ring->base.submit = uring_submit;
+    ring->base.register_buffer = uring_register_buffer;
+    ring->base.close = uring_close;
+    return &ring->base;
+}
+
+bool uring_submit(IoBackend *io, IoOp op, IoRequest *requests, uint32_t count) {
+    IoUring *ring = (IoUring *) io;
+    for (uint32_t done = 0; done < count;) {
+        const uint32_t batch = count - done < ring->entries ? count - done : ring->entries;
+        if (ring->error == 0) {
+            uring_run(ring, op, requests + done, batch);
+        } else {
+            for (uint32_t i = done; i < done + batch; i++) {
+                requests[i].result = -ring->error;
+            }
+        }
+        done += batch;
+    }
+    bool success = true;
+    for (uint32_t i = 0; i < count; i++) {
+        success &= io_complete(io->fd, op, &requests[i]);
+    }
+    return success;
+}
+
+/*
+ * Queues count <= entries requests, submits them with one io_uring_enter and waits for all of them.
+ * If io_uring_enter fails, the requests still waiting get its errno and ring->error is set.
+ */
+void uring_run(IoUring *ring, IoOp op, IoRequest *requests, uint32_t count) {
+    unsigned tail = *ring->sq_tail;
+    for (uint32_t i = 0; i < count; i++) {
+        IoRequest *request = &requests[i];
+        request->result = -ECANCELED;
+        const unsigned index = tail++ & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        const char *base = request->iov[0].iov_base;
+        const bool fixed = request->iovcnt == 1 && ring->fixed_buffer != NULL && base >= ring->fixed_buffer &&
+                           base + request->iov[0].iov_len <= ring->fixed_buffer + ring->fixed_size;
+        if (fixed) {
+            sqe->opcode = op == IO_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = (uint64_t) (uintptr_t) base;
+            sqe->len = request->iov[0].iov_len;
+            sqe->buf_index = 0;
+        } else {
+            sqe->opcode = op == IO_READ ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = (uint64_t) (uintptr_t) request->iov;
+            sqe->len = request->iovcnt;
+        }
+        sqe->fd = ring->base.fd;
+        sqe->off = request->offset;
+        sqe->user_data = i;
+        ring->sq_array[index] = index;
+    }
+    // The kernel must see the entries before the new tail
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+    while (completed < count) {
+        const int ret = (int) syscall(__NR_io_uring_enter, ring->ring_fd, count - submitted, count - completed,
+                                      IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            ring->error = errno;
+            for (uint32_t i = 0; i < count; i++) {
+                if (requests[i].result == -ECANCELED) {
+                    requests[i].result = -ring->error;
+                }
+            }
+            return;
+        }
+        if (ret > 0) {
+            submitted += ret;
+        }
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            requests[cqe->user_data].result = cqe->res;
+            head++;
+            completed++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void uring_register_buffer(IoBackend *io, void *buffer, size_t size) {
+    IoUring *ring = (IoUring *) io;
+    if (ring->fixed_buffer != NULL) {
+        return;
+    }
+    struct iovec iov = {.iov_base = buffer, .iov_len = size};
+    // May fail under a low RLIMIT_MEMLOCK; requests then just don't use the fixed buffer
+    if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+        ring->fixed_buffer = buffer;
+        ring->fixed_size = size;
+    }
+}
+
+void uring_close(IoBackend *io) {
+    IoUring *ring = (IoUring *) io;
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    // Closing the ring also unregisters the fixed buffer
+    close(ring->ring_fd);
+    free(ring);
+}
+
+#else
+
+IoBackend *uring_open(int fd) {
+    (void) fd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+#endif
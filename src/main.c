@@ -1,4 +1,7 @@
 #include "../inc/command.h"
+#include "../inc/shard.h"
+#include "../inc/profile.h"
+#include "../inc/memtable.h"
 
 void print_prompt() { printf("\ndb > "); }
 
@@ -16,12 +19,45 @@ void read_input(InputBuffer *input_buffer) {
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    uint32_t flags = 0;
+    char *filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cow") == 0) {
+            flags |= DB_OPEN_COW;
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            flags |= DB_OPEN_IO_URING;
+        } else if (strcmp(argv[i], "--hash") == 0) {
+            flags |= DB_OPEN_HASH;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            const long num_shards = strtol(argv[++i], NULL, 10);
+            if (num_shards < 1 || num_shards > SHARD_MAX) {
+                printf("Shard count must be between 1 and %d\n", SHARD_MAX);
+                exit(EXIT_FAILURE);
+            }
+            flags |= DB_OPEN_SHARDS(num_shards);
+        } else if (strcmp(argv[i], "--memtable") == 0 && i + 1 < argc) {
+            const long rows = strtol(argv[++i], NULL, 10);
+            if (rows < 1 || rows > MEMTABLE_MAX_ROWS) {
+                printf("Memtable size must be between 1 and %d rows\n", MEMTABLE_MAX_ROWS);
+                exit(EXIT_FAILURE);
+            }
+            flags |= DB_OPEN_MEMTABLE(rows);
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename == NULL) {
         printf("Must supply a database filename\n");
         exit(EXIT_FAILURE);
     }
-    char *filename = argv[1];
-    Table *table = db_open(filename);
+    Table *table = db_open(filename, flags);
+    if (table == NULL) {
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((flags & DB_OPEN_IO_URING) && table->pager != NULL && table->pager->io->kind != IO_URING) {
+        fprintf(stderr, "io_uring unavailable, using read/write syscalls\n");
+    }
 
     InputBuffer *input_buffer = new_input_buffer();
     while (true) {
@@ -37,8 +73,10 @@ int main(int argc, char *argv[]) {
                     continue;
             }
         }
+        const uint64_t wall_start = profile_clock_ns(CLOCK_MONOTONIC);
+        const uint64_t cpu_start = profile_clock_ns(CLOCK_PROCESS_CPUTIME_ID);
         Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
+        switch (prepare_statement(input_buffer, table, &statement)) {
             case (PREPARE_SUCCESS):
                 break;
             case (PREPARE_SYNTAX_ERROR):
@@ -53,6 +91,13 @@ int main(int argc, char *argv[]) {
             case PREPARE_NEGATIVE_ID:
                 printf("Cannot insert negative id\n");
                 continue;
+            case PREPARE_ROW_TOO_WIDE:
+                printf("Row is too wide\n");
+                continue;
+        }
+        if (statement.num_params > 0) {
+            printf("Parameters can only be bound through the library API.\n");
+            continue;
         }
 
         switch (execute_statement(&statement, table)) {
@@ -65,6 +110,23 @@ int main(int argc, char *argv[]) {
             case (EXECUTE_TABLE_FULL):
                 printf("Error: Table full.\n");
                 break;
+            case (EXECUTE_TABLE_EXISTS):
+                printf("Error: Table already exists.\n");
+                break;
+            case (EXECUTE_IO_ERROR):
+                printf("Error: I/O error on the db file.\n");
+                break;
+            case (EXECUTE_UNORDERED):
+                printf("Error: Hash tables have no key order.\n");
+                break;
+            case (EXECUTE_SCHEMA):
+                printf("Error: Only users rows have username and email columns.\n");
+                break;
+        }
+        if (profile_timer()) {
+            // CPU time is for the whole process, so it includes the background flushers
+            printf("Run Time: real %.6f cpu %.6f\n", (profile_clock_ns(CLOCK_MONOTONIC) - wall_start) / 1e9,
+                   (profile_clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start) / 1e9);
         }
     }
 
@@ -0,0 +1,347 @@
+#include "../inc/memtable.h"
+
+uint32_t memtable_random_level(Memtable *memtable);
+
+void memtable_insert(Memtable *memtable, uint32_t key, const void *value);
+
+void memtable_drop_before(Memtable *memtable, const MemtableNode *stop, uint32_t dropped);
+
+void memtable_merge_leaf(void *leaf, const MemtableNode *node, uint32_t batch);
+
+bool memtable_tree_has_row(const Cursor *cursor);
+
+void memtable_cursor_merge(Cursor *cursor);
+
+Cursor memtable_tree_cursor(const Cursor *cursor);
+
+bool memtable_has_room(const Table *table, uint32_t rows);
+
+Memtable *memtable_open(uint32_t capacity) {
+    Memtable *memtable = malloc(sizeof(Memtable));
+    latch_init_prefer_writer(&memtable->latch);
+    memtable->head = calloc(1, sizeof(MemtableNode));
+    memtable->head->level = MEMTABLE_MAX_LEVEL;
+    memtable->level = 1;
+    memtable->count = 0;
+    memtable->capacity = capacity;
+    memtable->used = 0;
+    // Keep every node's tower pointer-aligned
+    memtable->node_size = (sizeof(MemtableNode) + ROW_SIZE + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    memtable->pool = malloc(memtable->node_size * capacity);
+    memtable->random_state = 2463534242u;
+    return memtable;
+}
+
+void memtable_close(Memtable *memtable) {
+    pthread_rwlock_destroy(&memtable->latch);
+    free(memtable->pool);
+    free(memtable->head);
+    free(memtable);
+}
+
+// xorshift32; each level is kept with probability 1/4
+uint32_t memtable_random_level(Memtable *memtable) {
+    uint32_t level = 1;
+    while (level < MEMTABLE_MAX_LEVEL) {
+        uint32_t x = memtable->random_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        memtable->random_state = x;
+        if ((x & 3) != 0) {
+            break;
+        }
+        level++;
+    }
+    return level;
+}
+
+MemtableNode *memtable_seek(const Memtable *memtable, uint32_t key) {
+    MemtableNode *node = memtable->head;
+    for (int32_t i = (int32_t) memtable->level - 1; i >= 0; i--) {
+        while (node->next[i] != NULL && node->next[i]->key < key) {
+            node = node->next[i];
+        }
+    }
+    return node->next[0];
+}
+
+MemtableNode *memtable_seek_before(const Memtable *memtable, uint32_t key) {
+    MemtableNode *node = memtable->head;
+    for (int32_t i = (int32_t) memtable->level - 1; i >= 0; i--) {
+        while (node->next[i] != NULL && node->next[i]->key < key) {
+            node = node->next[i];
+        }
+    }
+    return node == memtable->head ? NULL : node;
+}
+
+// The key must not be buffered yet, and the pool must have a free node
+void memtable_insert(Memtable *memtable, uint32_t key, const void *value) {
+    assert(memtable->used < memtable->capacity);
+    MemtableNode *update[MEMTABLE_MAX_LEVEL];
+    MemtableNode *node = memtable->head;
+    for (int32_t i = (int32_t) memtable->level - 1; i >= 0; i--) {
+        while (node->next[i] != NULL && node->next[i]->key < key) {
+            node = node->next[i];
+        }
+        update[i] = node;
+    }
+
+    const uint32_t level = memtable_random_level(memtable);
+    for (uint32_t i = memtable->level; i < level; i++) {
+        update[i] = memtable->head;
+    }
+    if (level > memtable->level) {
+        memtable->level = level;
+    }
+
+    MemtableNode *inserted = (MemtableNode *) (memtable->pool + memtable->node_size * memtable->used++);
+    inserted->key = key;
+    inserted->level = level;
+    memcpy(inserted->value, value, ROW_SIZE);
+    for (uint32_t i = 0; i < level; i++) {
+        inserted->next[i] = update[i]->next[i];
+        update[i]->next[i] = inserted;
+    }
+    memtable->count++;
+}
+
+// Unlinks every node before stop, which is NULL to empty the skiplist
+void memtable_drop_before(Memtable *memtable, const MemtableNode *stop, uint32_t dropped) {
+    for (uint32_t i = 0; i < MEMTABLE_MAX_LEVEL; i++) {
+        MemtableNode *node = memtable->head->next[i];
+        while (node != NULL && stop != NULL && node->key < stop->key) {
+            node = node->next[i];
+        }
+        memtable->head->next[i] = stop == NULL ? NULL : node;
+    }
+    memtable->count -= dropped;
+    if (memtable->count == 0) {
+        // Nodes are only reused once none is linked
+        memtable->used = 0;
+        memtable->level = 1;
+    }
+}
+
+ExecuteResult memtable_execute_insert(const Statement *statement, Table *table) {
+    Memtable *memtable = table->memtable;
+    const uint32_t key = statement->row_to_insert.id;
+    pthread_rwlock_wrlock(&memtable->latch);
+
+    const MemtableNode *node = memtable_seek(memtable, key);
+    bool duplicate = node != NULL && node->key == key;
+    if (!duplicate) {
+        Cursor cursor;
+        tree_find(table, key, &cursor);
+        duplicate = cursor_holds_key(&cursor, key);
+        cursor_close(&cursor);
+    }
+
+    if (duplicate) {
+        pthread_rwlock_unlock(&memtable->latch);
+        return EXECUTE_DUPLICATE_KEY;
+    }
+    if (memtable->used == memtable->capacity || !memtable_has_room(table, memtable->count + 1)) {
+        // The reservation rules out running out of pages, but an I/O error can still stop the merge
+        if (!memtable_merge(table) || table_io_error(table) != 0) {
+            pthread_rwlock_unlock(&memtable->latch);
+            return table_io_error(table) != 0 ? EXECUTE_IO_ERROR : EXECUTE_TABLE_FULL;
+        }
+    }
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+    if (memtable->used == memtable->capacity || !memtable_has_room(table, 1)) {
+        // Too close to full to promise a worst-case merge, so the tree decides whether this one fits
+        result = tree_execute_insert(statement, table);
+    } else if (statement->has_record) {
+        memtable_insert(memtable, key, statement->record);
+    } else {
+        uint8_t record[SCHEMA_RECORD_MAX_SIZE];
+        serialize_row(&statement->row_to_insert, record);
+        memtable_insert(memtable, key, record);
+    }
+    pthread_rwlock_unlock(&memtable->latch);
+    return result;
+}
+
+/*
+ * A buffered row is acknowledged, so the tree must be able to take it whatever the merge runs into.
+ * In the worst case each row splits its leaf, every internal node above it and the root, which
+ * costs one page more: height + 1 pages. Every internal node keeps at least two children, so
+ * however the rows land the tree stays within 1 + log2(nodes) levels.
+ */
+bool memtable_has_room(const Table *table, uint32_t rows) {
+    const uint32_t num_pages = table->pager->num_pages;
+    uint32_t height = 1;
+    for (uint64_t nodes = (uint64_t) num_pages + rows; nodes > 1; nodes >>= 1) {
+        height++;
+    }
+    return (uint64_t) rows * (height + 1) <= TABLE_MAX_PAGES - num_pages;
+}
+
+bool memtable_merge(Table *table) {
+    Memtable *memtable = table->memtable;
+    MemtableNode *node = memtable->head->next[0];
+    uint32_t merged = 0;
+    bool success = true;
+    while (node != NULL) {
+        Cursor cursor;
+        table_find_for_insert(table, node->key, &cursor);
+        void *leaf = get_page(table->pager, cursor.page_num);
+        const uint32_t num_cells = *leaf_node_num_cells(leaf);
+
+        if (num_cells >= LEAF_NODE_MAX_CELLS) {
+            // A full leaf takes one key through the split path; the keys after it find room in a half
+            success = table_can_insert(&cursor, node->key);
+            if (success) {
+                leaf_node_insert(&cursor, node->key, node->value);
+                node = node->next[0];
+                merged++;
+            }
+            cursor_close(&cursor);
+            if (!success) {
+                break;
+            }
+            continue;
+        }
+
+        // The following keys land in this leaf too while they stay below its largest key, or all of
+        // them if it is the right-most leaf
+        const bool rightmost = *leaf_node_next_leaf(leaf) == 0;
+        const uint32_t max_key = num_cells > 0 ? *leaf_node_key(leaf, num_cells - 1) : 0;
+        MemtableNode *end = node;
+        uint32_t batch = 0;
+        do {
+            end = end->next[0];
+            batch++;
+        } while (end != NULL && num_cells + batch < LEAF_NODE_MAX_CELLS && (rightmost || end->key < max_key));
+        memtable_merge_leaf(leaf, node, batch);
+        pager_mark_dirty(table->pager, cursor.page_num);
+        cursor_close(&cursor);
+        node = end;
+        merged += batch;
+    }
+    memtable_drop_before(memtable, node, merged);
+    return success;
+}
+
+/*
+ * Merges batch nodes, starting at node, into a leaf with room for them. The existing cells slide up by
+ * batch, then both sorted runs are merged forward into the gap; the write position never passes the
+ * read position.
+ */
+void memtable_merge_leaf(void *leaf, const MemtableNode *node, uint32_t batch) {
+    const uint32_t num_cells = *leaf_node_num_cells(leaf);
+    memmove(leaf_node_cell(leaf, batch), leaf_node_cell(leaf, 0), (size_t) num_cells * LEAF_NODE_CELL_SIZE);
+    const uint32_t end = batch + num_cells;
+    uint32_t read = batch;
+    for (uint32_t write = 0; write < end; write++) {
+        if (batch > 0 && (read == end || node->key < *leaf_node_key(leaf, read))) {
+            *leaf_node_key(leaf, write) = node->key;
+            memcpy(leaf_node_value(leaf, write), node->value, ROW_SIZE);
+            node = node->next[0];
+            batch--;
+        } else {
+            memmove(leaf_node_cell(leaf, write), leaf_node_cell(leaf, read), LEAF_NODE_CELL_SIZE);
+            read++;
+        }
+    }
+    *leaf_node_num_cells(leaf) = end;
+}
+
+/*
+ * The merged cursor keeps the tree's position in its own fields rather than in a second Cursor,
+ * so a scan allocates nothing. This marks it merged once the tree part has moved.
+ */
+void memtable_cursor_merge(Cursor *cursor) {
+    cursor->merges_memtable = true;
+    cursor->tree_end_of_table = cursor->end_of_table;
+    cursor->end_of_table = cursor->tree_end_of_table && cursor->memtable_node == NULL;
+}
+
+// The plain tree cursor the merged cursor's fields describe
+Cursor memtable_tree_cursor(const Cursor *cursor) {
+    Cursor tree = *cursor;
+    tree.merges_memtable = false;
+    tree.end_of_table = cursor->tree_end_of_table;
+    return tree;
+}
+
+void memtable_table_start(Table *table, Cursor *cursor) {
+    Memtable *memtable = table->memtable;
+    pthread_rwlock_rdlock(&memtable->latch);
+    tree_start(table, cursor);
+    cursor->descending = false;
+    cursor->memtable_node = memtable->head->next[0];
+    memtable_cursor_merge(cursor);
+}
+
+void memtable_table_find(Table *table, uint32_t key, Cursor *cursor) {
+    Memtable *memtable = table->memtable;
+    pthread_rwlock_rdlock(&memtable->latch);
+    tree_find(table, key, cursor);
+    cursor->descending = false;
+    cursor->memtable_node = memtable_seek(memtable, key);
+    memtable_cursor_merge(cursor);
+}
+
+void memtable_table_end(Table *table, Cursor *cursor) {
+    Memtable *memtable = table->memtable;
+    pthread_rwlock_rdlock(&memtable->latch);
+    tree_end(table, cursor);
+    cursor->descending = true;
+    // The last node is UINT32_MAX itself if that is buffered, otherwise the last key below it
+    MemtableNode *last = memtable_seek(memtable, UINT32_MAX);
+    cursor->memtable_node = last != NULL ? last : memtable_seek_before(memtable, UINT32_MAX);
+    memtable_cursor_merge(cursor);
+}
+
+// A cursor from tree_find may sit past the last cell of its leaf
+bool memtable_tree_has_row(const Cursor *cursor) {
+    return !cursor->tree_end_of_table &&
+           cursor->cell_num < *leaf_node_num_cells(get_page(cursor->table->pager, cursor->page_num));
+}
+
+// Keys are unique across the skiplist and the tree, so the smaller one, or the larger one going
+// backwards, is the current row
+bool memtable_cursor_on_memtable(const Cursor *cursor) {
+    if (cursor->memtable_node == NULL) {
+        return false;
+    }
+    if (!memtable_tree_has_row(cursor)) {
+        return true;
+    }
+    const uint32_t tree_key = *leaf_node_key(get_page(cursor->table->pager, cursor->page_num), cursor->cell_num);
+    return cursor->descending ? cursor->memtable_node->key > tree_key : cursor->memtable_node->key < tree_key;
+}
+
+void memtable_cursor_advance(Cursor *cursor) {
+    if (memtable_cursor_on_memtable(cursor)) {
+        cursor->memtable_node = cursor->memtable_node->next[0];
+        cursor->end_of_table = cursor->tree_end_of_table && cursor->memtable_node == NULL;
+        return;
+    }
+    Cursor tree = memtable_tree_cursor(cursor);
+    cursor_advance(&tree);
+    *cursor = tree;
+    memtable_cursor_merge(cursor);
+}
+
+void memtable_cursor_retreat(Cursor *cursor) {
+    if (memtable_cursor_on_memtable(cursor)) {
+        cursor->memtable_node = memtable_seek_before(cursor->table->memtable, cursor->memtable_node->key);
+        cursor->end_of_table = cursor->tree_end_of_table && cursor->memtable_node == NULL;
+        return;
+    }
+    Cursor tree = memtable_tree_cursor(cursor);
+    cursor_retreat(&tree);
+    *cursor = tree;
+    memtable_cursor_merge(cursor);
+}
+
+void memtable_cursor_close(Cursor *cursor) {
+    Cursor tree = memtable_tree_cursor(cursor);
+    cursor_close(&tree);
+    pthread_rwlock_unlock(&cursor->table->memtable->latch);
+}
@@ -0,0 +1,121 @@
+#include "../inc/profile.h"
+
+uint32_t profile_bucket(uint64_t value);
+
+uint64_t profile_bucket_limit(uint32_t bucket);
+
+uint64_t profile_percentile(const ProfileHistogram *histogram, uint64_t count, double p);
+
+const char *const PROFILE_POINT_NAMES[PROFILE_POINT_COUNT] = {
+        "insert", "select", "prepare", "find", "get_page_io", "split", "print_row",
+};
+
+atomic_bool profiling = false;
+bool timing = false;
+ProfileHistogram histograms[PROFILE_POINT_COUNT];
+
+void profile_enable(bool enabled) {
+    if (enabled) {
+        memset(histograms, 0, sizeof(histograms));
+    }
+    atomic_store(&profiling, enabled);
+}
+
+bool profile_enabled(void) {
+    return atomic_load_explicit(&profiling, memory_order_relaxed);
+}
+
+void profile_set_timer(bool enabled) {
+    timing = enabled;
+}
+
+bool profile_timer(void) {
+    return timing;
+}
+
+uint64_t profile_clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t profile_start(void) {
+    if (!profile_enabled()) {
+        return 0;
+    }
+    return profile_clock_ns(CLOCK_MONOTONIC);
+}
+
+/*
+ * Values below PROFILE_SUB_BUCKETS get a bucket each. Above that, the top bit picks the power of
+ * two and the next PROFILE_SUB_BUCKET_BITS bits pick the sub-bucket.
+ */
+uint32_t profile_bucket(uint64_t value) {
+    if (value < PROFILE_SUB_BUCKETS) {
+        return (uint32_t) value;
+    }
+    const uint32_t exponent = 63 - __builtin_clzll(value);
+    const uint32_t shift = exponent - PROFILE_SUB_BUCKET_BITS;
+    const uint32_t sub_bucket = (uint32_t) (value >> shift) & (PROFILE_SUB_BUCKETS - 1);
+    return (shift + 1) * PROFILE_SUB_BUCKETS + sub_bucket;
+}
+
+// Highest value that falls into the bucket
+uint64_t profile_bucket_limit(uint32_t bucket) {
+    if (bucket < PROFILE_SUB_BUCKETS) {
+        return bucket;
+    }
+    const uint32_t shift = bucket / PROFILE_SUB_BUCKETS - 1;
+    const uint64_t sub_bucket = bucket % PROFILE_SUB_BUCKETS;
+    return ((PROFILE_SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void profile_record(ProfilePoint point, uint64_t start) {
+    if (start == 0) {
+        return;
+    }
+    const uint64_t elapsed = profile_clock_ns(CLOCK_MONOTONIC) - start;
+    ProfileHistogram *histogram = &histograms[point];
+    atomic_fetch_add_explicit(&histogram->counts[profile_bucket(elapsed)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->total_ns, elapsed, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    while (elapsed > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max_ns, &max, elapsed, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+uint64_t profile_percentile(const ProfileHistogram *histogram, uint64_t count, double p) {
+    // Rank of the sample at percentile p, counted from 1
+    const uint64_t rank = (uint64_t) (p * (double) count + 0.999999);
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+        seen += atomic_load_explicit(&histogram->counts[bucket], memory_order_relaxed);
+        if (seen >= rank) {
+            return profile_bucket_limit(bucket);
+        }
+    }
+    return atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+}
+
+void profile_summary(ProfilePoint point, ProfileSummary *summary) {
+    const ProfileHistogram *histogram = &histograms[point];
+    memset(summary, 0, sizeof(ProfileSummary));
+    summary->count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    if (summary->count == 0) {
+        return;
+    }
+    summary->mean_ns = atomic_load_explicit(&histogram->total_ns, memory_order_relaxed) / summary->count;
+    summary->max_ns = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    summary->p50_ns = profile_percentile(histogram, summary->count, 0.50);
+    summary->p99_ns = profile_percentile(histogram, summary->count, 0.99);
+    summary->p999_ns = profile_percentile(histogram, summary->count, 0.999);
+    // A bucket's limit can overshoot the largest sample that actually landed in it
+    uint64_t *percentiles[] = {&summary->p50_ns, &summary->p99_ns, &summary->p999_ns};
+    for (uint32_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+        if (*percentiles[i] > summary->max_ns) {
+            *percentiles[i] = summary->max_ns;
+        }
+    }
+}
@@ -0,0 +1,534 @@
+#include "../inc/schema.h"
+
+const char CATALOG_MAGIC[8] = {'S', 'D', 'B', 'C', 'A', 'T', 'L', 'G'};
+const uint32_t CATALOG_NUM_COLUMNS_OFFSET = sizeof(CATALOG_MAGIC);
+const uint32_t CATALOG_TABLE_NAME_OFFSET = CATALOG_NUM_COLUMNS_OFFSET + sizeof(uint32_t);
+const uint32_t CATALOG_COLUMNS_OFFSET = CATALOG_TABLE_NAME_OFFSET + SCHEMA_NAME_SIZE;
+// Each column: name, then type and length as uint32_t
+const uint32_t CATALOG_COLUMN_SIZE = SCHEMA_NAME_SIZE + 2 * sizeof(uint32_t);
+
+const char *const COLUMN_TYPE_NAMES[] = {"int32", "int64", "double", "char", "varchar"};
+
+CodecResult int32_encode(const char *text, void *slot, uint32_t length);
+
+CodecResult int64_encode(const char *text, void *slot, uint32_t length);
+
+CodecResult double_encode(const char *text, void *slot, uint32_t length);
+
+CodecResult char_encode(const char *text, void *slot, uint32_t length);
+
+CodecResult varchar_encode(const char *text, void *slot, uint32_t length);
+
+size_t int32_format(const void *slot, uint32_t length, char *out);
+
+size_t int64_format(const void *slot, uint32_t length, char *out);
+
+size_t double_format(const void *slot, uint32_t length, char *out);
+
+size_t char_format(const void *slot, uint32_t length, char *out);
+
+size_t varchar_format(const void *slot, uint32_t length, char *out);
+
+CodecResult int32_encode_int(int64_t value, void *slot, uint32_t length);
+
+CodecResult int64_encode_int(int64_t value, void *slot, uint32_t length);
+
+CodecResult double_encode_int(int64_t value, void *slot, uint32_t length);
+
+CodecResult text_encode_int(int64_t value, void *slot, uint32_t length);
+
+CodecResult number_encode_double(double value, void *slot, uint32_t length);
+
+CodecResult double_encode_double(double value, void *slot, uint32_t length);
+
+CodecResult text_encode_double(double value, void *slot, uint32_t length);
+
+int int32_compare(const void *a, const void *b, uint32_t length);
+
+int int64_compare(const void *a, const void *b, uint32_t length);
+
+int double_compare(const void *a, const void *b, uint32_t length);
+
+int char_compare(const void *a, const void *b, uint32_t length);
+
+int varchar_compare(const void *a, const void *b, uint32_t length);
+
+char *catalog_path(const char *filename);
+
+bool schema_compile(Schema *schema) {
+    schema->record_size = 0;
+    if (schema->num_columns == 0 || schema->num_columns > SCHEMA_MAX_COLUMNS ||
+        schema->columns[0].type != COLUMN_TYPE_INT32) {
+        return false;
+    }
+    uint64_t record_size = 0;// Wide enough for any column lengths
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        const ColumnDef *column = &schema->columns[i];
+        ColumnCodec *codec = &schema->codecs[i];
+        codec->offset = (uint32_t) record_size;
+        codec->length = column->length;
+        uint64_t slot_size = 0;
+        switch (column->type) {
+            case COLUMN_TYPE_INT32:
+                slot_size = sizeof(int32_t);
+                codec->encode = int32_encode;
+                codec->encode_int = int32_encode_int;
+                codec->encode_double = number_encode_double;
+                codec->format = int32_format;
+                codec->compare = int32_compare;
+                break;
+            case COLUMN_TYPE_INT64:
+                slot_size = sizeof(int64_t);
+                codec->encode = int64_encode;
+                codec->encode_int = int64_encode_int;
+                codec->encode_double = number_encode_double;
+                codec->format = int64_format;
+                codec->compare = int64_compare;
+                break;
+            case COLUMN_TYPE_DOUBLE:
+                slot_size = sizeof(double);
+                codec->encode = double_encode;
+                codec->encode_int = double_encode_int;
+                codec->encode_double = double_encode_double;
+                codec->format = double_format;
+                codec->compare = double_compare;
+                break;
+            case COLUMN_TYPE_CHAR:
+                slot_size = (uint64_t) column->length + 1;
+                codec->encode = char_encode;
+                codec->encode_int = text_encode_int;
+                codec->encode_double = text_encode_double;
+                codec->format = char_format;
+                codec->compare = char_compare;
+                break;
+            case COLUMN_TYPE_VARCHAR:
+                slot_size = sizeof(uint16_t) + (uint64_t) column->length;
+                codec->encode = varchar_encode;
+                codec->encode_int = text_encode_int;
+                codec->encode_double = text_encode_double;
+                codec->format = varchar_format;
+                codec->compare = varchar_compare;
+                break;
+            default:
+                return false;
+        }
+        if ((column->type == COLUMN_TYPE_CHAR || column->type == COLUMN_TYPE_VARCHAR) && column->length == 0) {
+            return false;
+        }
+        for (uint32_t j = 0; j < i; j++) {
+            if (strcmp(schema->columns[j].name, column->name) == 0) {
+                return false;
+            }
+        }
+        codec->size = (uint32_t) slot_size;
+        record_size += slot_size;
+    }
+    schema->record_size = record_size > UINT32_MAX ? UINT32_MAX : (uint32_t) record_size;
+    return record_size <= SCHEMA_RECORD_MAX_SIZE;
+}
+
+void schema_users(Schema *schema) {
+    memset(schema, 0, sizeof(Schema));
+    strcpy(schema->table_name, "users");
+    schema->num_columns = 3;
+    strcpy(schema->columns[0].name, "id");
+    schema->columns[0].type = COLUMN_TYPE_INT32;
+    strcpy(schema->columns[1].name, "username");
+    schema->columns[1].type = COLUMN_TYPE_CHAR;
+    schema->columns[1].length = COLUMN_USERNAME_SIZE;
+    strcpy(schema->columns[2].name, "email");
+    schema->columns[2].type = COLUMN_TYPE_CHAR;
+    schema->columns[2].length = COLUMN_EMAIL_SIZE;
+    schema_compile(schema);
+}
+
+uint32_t schema_find_column(const Schema *schema, const char *name) {
+    uint32_t i = 0;
+    while (i < schema->num_columns && strcmp(schema->columns[i].name, name) != 0) {
+        i++;
+    }
+    return i;
+}
+
+CodecResult schema_encode(const Schema *schema, char *const *text, void *record, uint32_t *key) {
+    memset(record, 0, SCHEMA_RECORD_MAX_SIZE);
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        const ColumnCodec *codec = &schema->codecs[i];
+        if (text[i] == NULL) {
+            continue;
+        }
+        const CodecResult result = codec->encode(text[i], record + codec->offset, codec->length);
+        if (result != CODEC_OK) {
+            return result;
+        }
+    }
+    *key = (uint32_t) schema_record_key(record);
+    return CODEC_OK;
+}
+
+CodecResult schema_bind_text(const Schema *schema, uint32_t column, const char *text, void *record) {
+    const ColumnCodec *codec = &schema->codecs[column];
+    memset(record + codec->offset, 0, codec->size);
+    return codec->encode(text, record + codec->offset, codec->length);
+}
+
+CodecResult schema_bind_int(const Schema *schema, uint32_t column, int64_t value, void *record) {
+    const ColumnCodec *codec = &schema->codecs[column];
+    memset(record + codec->offset, 0, codec->size);
+    return codec->encode_int(value, record + codec->offset, codec->length);
+}
+
+CodecResult schema_bind_double(const Schema *schema, uint32_t column, double value, void *record) {
+    const ColumnCodec *codec = &schema->codecs[column];
+    memset(record + codec->offset, 0, codec->size);
+    return codec->encode_double(value, record + codec->offset, codec->length);
+}
+
+int32_t schema_record_key(const void *record) {
+    int32_t id;
+    memcpy(&id, record, sizeof(int32_t));
+    return id;
+}
+
+CodecResult schema_column_int(const Schema *schema, const void *record, uint32_t column, int64_t *value) {
+    const void *slot = record + schema->codecs[column].offset;
+    switch (schema->columns[column].type) {
+        case COLUMN_TYPE_INT32: {
+            int32_t value32;
+            memcpy(&value32, slot, sizeof(int32_t));
+            *value = value32;
+            return CODEC_OK;
+        }
+        case COLUMN_TYPE_INT64:
+            memcpy(value, slot, sizeof(int64_t));
+            return CODEC_OK;
+        default:
+            return CODEC_INVALID;
+    }
+}
+
+CodecResult schema_column_double(const Schema *schema, const void *record, uint32_t column, double *value) {
+    if (schema->columns[column].type != COLUMN_TYPE_DOUBLE) {
+        return CODEC_INVALID;
+    }
+    memcpy(value, record + schema->codecs[column].offset, sizeof(double));
+    return CODEC_OK;
+}
+
+void schema_column_text(const Schema *schema, const void *record, uint32_t column, char *out) {
+    const ColumnCodec *codec = &schema->codecs[column];
+    out[codec->format(record + codec->offset, codec->length, out)] = '\0';
+}
+
+void schema_format(const Schema *schema, const void *record, char *line) {
+    char *out = line;
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        const ColumnCodec *codec = &schema->codecs[i];
+        if (i > 0) {
+            *out++ = ' ';
+        }
+        out += codec->format(record + codec->offset, codec->length, out);
+    }
+    *out = '\0';
+}
+
+void schema_describe(const Schema *schema, char *line) {
+    int written = sprintf(line, "create table %s (", schema->table_name);
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        const ColumnDef *column = &schema->columns[i];
+        written += sprintf(line + written, "%s%s %s", i > 0 ? ", " : "", column->name, COLUMN_TYPE_NAMES[column->type]);
+        if (column->type == COLUMN_TYPE_CHAR || column->type == COLUMN_TYPE_VARCHAR) {
+            written += sprintf(line + written, "(%u)", column->length);
+        }
+    }
+    sprintf(line + written, ")");
+}
+
+/*
+ * Encoders: text must hold the whole value
+ */
+
+CodecResult int32_encode(const char *text, void *slot, uint32_t length) {
+    (void) length;
+    char *end;
+    errno = 0;
+    const long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || value < INT32_MIN || value > INT32_MAX) {
+        return CODEC_INVALID;
+    }
+    const int32_t value32 = (int32_t) value;
+    memcpy(slot, &value32, sizeof(int32_t));
+    return CODEC_OK;
+}
+
+CodecResult int64_encode(const char *text, void *slot, uint32_t length) {
+    (void) length;
+    char *end;
+    errno = 0;
+    const long long value = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE) {
+        return CODEC_INVALID;
+    }
+    const int64_t value64 = value;
+    memcpy(slot, &value64, sizeof(int64_t));
+    return CODEC_OK;
+}
+
+CodecResult double_encode(const char *text, void *slot, uint32_t length) {
+    (void) length;
+    char *end;
+    const double value = strtod(text, &end);
+    if (end == text || *end != '\0') {
+        return CODEC_INVALID;
+    }
+    memcpy(slot, &value, sizeof(double));
+    return CODEC_OK;
+}
+
+CodecResult char_encode(const char *text, void *slot, uint32_t length) {
+    const size_t size = strlen(text);
+    if (size > length) {
+        return CODEC_TOO_LONG;
+    }
+    // The record is zeroed, so the value stays NUL padded
+    memcpy(slot, text, size);
+    return CODEC_OK;
+}
+
+CodecResult varchar_encode(const char *text, void *slot, uint32_t length) {
+    const size_t size = strlen(text);
+    if (size > length) {
+        return CODEC_TOO_LONG;
+    }
+    const uint16_t size16 = (uint16_t) size;
+    memcpy(slot, &size16, sizeof(uint16_t));
+    memcpy(slot + sizeof(uint16_t), text, size);
+    return CODEC_OK;
+}
+
+/*
+ * Typed encoders: numbers convert between the numeric types when the value fits, never to text
+ */
+
+CodecResult int32_encode_int(int64_t value, void *slot, uint32_t length) {
+    (void) length;
+    if (value < INT32_MIN || value > INT32_MAX) {
+        return CODEC_INVALID;
+    }
+    const int32_t value32 = (int32_t) value;
+    memcpy(slot, &value32, sizeof(int32_t));
+    return CODEC_OK;
+}
+
+CodecResult int64_encode_int(int64_t value, void *slot, uint32_t length) {
+    (void) length;
+    memcpy(slot, &value, sizeof(int64_t));
+    return CODEC_OK;
+}
+
+CodecResult double_encode_int(int64_t value, void *slot, uint32_t length) {
+    return double_encode_double((double) value, slot, length);
+}
+
+CodecResult text_encode_int(int64_t value, void *slot, uint32_t length) {
+    (void) value;
+    (void) slot;
+    (void) length;
+    return CODEC_INVALID;
+}
+
+CodecResult number_encode_double(double value, void *slot, uint32_t length) {
+    (void) slot;
+    (void) length;
+    (void) value;
+    // Truncating would store a different value than the caller bound
+    return CODEC_INVALID;
+}
+
+CodecResult double_encode_double(double value, void *slot, uint32_t length) {
+    (void) length;
+    memcpy(slot, &value, sizeof(double));
+    return CODEC_OK;
+}
+
+CodecResult text_encode_double(double value, void *slot, uint32_t length) {
+    (void) value;
+    (void) slot;
+    (void) length;
+    return CODEC_INVALID;
+}
+
+/*
+ * Formatters
+ */
+
+size_t int32_format(const void *slot, uint32_t length, char *out) {
+    (void) length;
+    int32_t value;
+    memcpy(&value, slot, sizeof(int32_t));
+    return sprintf(out, "%d", value);
+}
+
+size_t int64_format(const void *slot, uint32_t length, char *out) {
+    (void) length;
+    int64_t value;
+    memcpy(&value, slot, sizeof(int64_t));
+    return sprintf(out, "%lld", (long long) value);
+}
+
+size_t double_format(const void *slot, uint32_t length, char *out) {
+    (void) length;
+    double value;
+    memcpy(&value, slot, sizeof(double));
+    return sprintf(out, "%.15g", value);
+}
+
+size_t char_format(const void *slot, uint32_t length, char *out) {
+    const size_t size = strnlen(slot, length);
+    memcpy(out, slot, size);
+    return size;
+}
+
+size_t varchar_format(const void *slot, uint32_t length, char *out) {
+    uint16_t size;
+    memcpy(&size, slot, sizeof(uint16_t));
+    if (size > length) {
+        size = length;
+    }
+    memcpy(out, slot + sizeof(uint16_t), size);
+    return size;
+}
+
+/*
+ * Comparators: both slots belong to the same column
+ */
+
+int int32_compare(const void *a, const void *b, uint32_t length) {
+    (void) length;
+    int32_t value_a, value_b;
+    memcpy(&value_a, a, sizeof(int32_t));
+    memcpy(&value_b, b, sizeof(int32_t));
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+int int64_compare(const void *a, const void *b, uint32_t length) {
+    (void) length;
+    int64_t value_a, value_b;
+    memcpy(&value_a, a, sizeof(int64_t));
+    memcpy(&value_b, b, sizeof(int64_t));
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+int double_compare(const void *a, const void *b, uint32_t length) {
+    (void) length;
+    double value_a, value_b;
+    memcpy(&value_a, a, sizeof(double));
+    memcpy(&value_b, b, sizeof(double));
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+int char_compare(const void *a, const void *b, uint32_t length) {
+    // NUL padded, so the padding orders a prefix first
+    return memcmp(a, b, length);
+}
+
+int varchar_compare(const void *a, const void *b, uint32_t length) {
+    uint16_t size_a, size_b;
+    memcpy(&size_a, a, sizeof(uint16_t));
+    memcpy(&size_b, b, sizeof(uint16_t));
+    size_a = size_a > length ? length : size_a;
+    size_b = size_b > length ? length : size_b;
+    const int result = memcmp(a + sizeof(uint16_t), b + sizeof(uint16_t), size_a < size_b ? size_a : size_b);
+    return result != 0 ? result : (size_a > size_b) - (size_a < size_b);
+}
+
+/*
+ * Catalog page: magic, column count, table name, then each column's name, type and length
+ */
+
+char *catalog_path(const char *filename) {
+    const size_t path_size = strlen(filename) + sizeof(CATALOG_SUFFIX);
+    char *path = malloc(path_size);
+    snprintf(path, path_size, "%s%s", filename, CATALOG_SUFFIX);
+    return path;
+}
+
+Catalog *catalog_open(const char *filename) {
+    Catalog *catalog = malloc(sizeof(Catalog));
+    catalog->path = catalog_path(filename);
+    catalog->schema = NULL;
+
+    const int fd = open(catalog->path, O_RDONLY);
+    if (fd == -1) {
+        return catalog;
+    }
+    char *page = malloc(PAGE_SIZE);
+    const ssize_t bytes_read = read(fd, page, PAGE_SIZE);
+    close(fd);
+
+    Schema *schema = calloc(1, sizeof(Schema));
+    bool valid = bytes_read == (ssize_t) PAGE_SIZE && memcmp(page, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) == 0;
+    if (valid) {
+        memcpy(&schema->num_columns, page + CATALOG_NUM_COLUMNS_OFFSET, sizeof(uint32_t));
+        valid = schema->num_columns <= SCHEMA_MAX_COLUMNS;
+    }
+    if (valid) {
+        memcpy(schema->table_name, page + CATALOG_TABLE_NAME_OFFSET, SCHEMA_NAME_SIZE);
+        schema->table_name[SCHEMA_NAME_SIZE - 1] = '\0';
+        for (uint32_t i = 0; i < schema->num_columns; i++) {
+            const char *entry = page + CATALOG_COLUMNS_OFFSET + i * CATALOG_COLUMN_SIZE;
+            ColumnDef *column = &schema->columns[i];
+            uint32_t type;
+            memcpy(column->name, entry, SCHEMA_NAME_SIZE);
+            column->name[SCHEMA_NAME_SIZE - 1] = '\0';
+            memcpy(&type, entry + SCHEMA_NAME_SIZE, sizeof(uint32_t));
+            memcpy(&column->length, entry + SCHEMA_NAME_SIZE + sizeof(uint32_t), sizeof(uint32_t));
+            column->type = (ColumnType) type;
+        }
+        valid = schema_compile(schema);
+    }
+    free(page);
+    if (!valid) {
+        // Reading the rows with the wrong layout would only return garbage
+        free(schema);
+        catalog_close(catalog);
+        return NULL;
+    }
+    catalog->schema = schema;
+    return catalog;
+}
+
+bool catalog_create(Catalog *catalog, const Schema *schema) {
+    char *page = calloc(1, PAGE_SIZE);
+    memcpy(page, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    memcpy(page + CATALOG_NUM_COLUMNS_OFFSET, &schema->num_columns, sizeof(uint32_t));
+    memcpy(page + CATALOG_TABLE_NAME_OFFSET, schema->table_name, SCHEMA_NAME_SIZE);
+    for (uint32_t i = 0; i < schema->num_columns; i++) {
+        char *entry = page + CATALOG_COLUMNS_OFFSET + i * CATALOG_COLUMN_SIZE;
+        const ColumnDef *column = &schema->columns[i];
+        const uint32_t type = column->type;
+        memcpy(entry, column->name, SCHEMA_NAME_SIZE);
+        memcpy(entry + SCHEMA_NAME_SIZE, &type, sizeof(uint32_t));
+        memcpy(entry + SCHEMA_NAME_SIZE + sizeof(uint32_t), &column->length, sizeof(uint32_t));
+    }
+
+    const int fd = open(catalog->path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    bool success = fd != -1 && write(fd, page, PAGE_SIZE) == (ssize_t) PAGE_SIZE && fsync(fd) == 0;
+    if (fd != -1) {
+        success &= close(fd) == 0;
+    }
+    free(page);
+    if (!success) {
+        unlink(catalog->path);
+        return false;
+    }
+    catalog->schema = malloc(sizeof(Schema));
+    memcpy(catalog->schema, schema, sizeof(Schema));
+    return true;
+}
+
+void catalog_close(Catalog *catalog) {
+    free(catalog->schema);
+    free(catalog->path);
+    free(catalog);
+}
@@ -0,0 +1,208 @@
+#include "../inc/shard.h"
+
+void shard_pick(Cursor *cursor);
+
+Cursor *shard_claim_cursors(ShardSet *shards);
+
+/*
+ * Manifest Layout
+ */
+const char SHARD_MANIFEST_MAGIC[8] = {'S', 'D', 'B', 'S', 'H', 'A', 'R', 'D'};
+const uint32_t SHARD_MANIFEST_MAGIC_SIZE = sizeof(SHARD_MANIFEST_MAGIC);
+const uint32_t SHARD_MANIFEST_COUNT_OFFSET = SHARD_MANIFEST_MAGIC_SIZE;
+#define SHARD_MANIFEST_SIZE (sizeof(SHARD_MANIFEST_MAGIC) + sizeof(uint32_t))
+
+uint32_t shard_manifest_count(const char *filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    char manifest[SHARD_MANIFEST_SIZE];
+    const ssize_t bytes_read = read(fd, manifest, SHARD_MANIFEST_SIZE);
+    close(fd);
+
+    // A B+tree file starts with a node type byte, so it can never match the magic
+    if (bytes_read != (ssize_t) SHARD_MANIFEST_SIZE ||
+        memcmp(manifest, SHARD_MANIFEST_MAGIC, SHARD_MANIFEST_MAGIC_SIZE) != 0) {
+        return 0;
+    }
+    uint32_t num_shards;
+    memcpy(&num_shards, manifest + SHARD_MANIFEST_COUNT_OFFSET, sizeof(uint32_t));
+    return num_shards;
+}
+
+bool shard_manifest_write(const char *filename, uint32_t num_shards) {
+    const int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        return false;
+    }
+    char manifest[SHARD_MANIFEST_SIZE];
+    memcpy(manifest, SHARD_MANIFEST_MAGIC, SHARD_MANIFEST_MAGIC_SIZE);
+    memcpy(manifest + SHARD_MANIFEST_COUNT_OFFSET, &num_shards, sizeof(uint32_t));
+    const ssize_t bytes_written = write(fd, manifest, SHARD_MANIFEST_SIZE);
+    return close(fd) == 0 && bytes_written == (ssize_t) SHARD_MANIFEST_SIZE;
+}
+
+Table *shard_open(const char *filename, uint32_t flags) {
+    uint32_t num_shards = shard_manifest_count(filename);
+    const uint32_t requested = DB_OPEN_SHARD_COUNT(flags);
+    if (num_shards == 0) {
+        // An existing non-empty file is a plain table and cannot be re-partitioned in place
+        struct stat file_stat;
+        if (stat(filename, &file_stat) == 0 && file_stat.st_size > 0) {
+            return NULL;
+        }
+        if (!shard_manifest_write(filename, requested)) {
+            return NULL;
+        }
+        num_shards = requested;
+    } else if (requested > 1 && requested != num_shards) {
+        return NULL;
+    }
+    // The columns are the router's: shards only store the encoded rows
+    Catalog *catalog = catalog_open(filename);
+    if (catalog == NULL) {
+        return NULL;
+    }
+
+    ShardSet *shards = malloc(sizeof(ShardSet));
+    shards->num_shards = num_shards;
+    shards->tables = malloc(sizeof(Table *) * num_shards);
+    const uint32_t shard_flags = flags & ~DB_OPEN_SHARDS(0xff);
+    const size_t name_size = strlen(filename) + 8;
+    char *shard_filename = malloc(name_size);
+    for (uint32_t i = 0; i < num_shards; i++) {
+        snprintf(shard_filename, name_size, "%s.%u", filename, i);
+        shards->tables[i] = db_open(shard_filename, shard_flags);
+        if (shards->tables[i] == NULL) {
+            for (uint32_t j = 0; j < i; j++) {
+                db_close(shards->tables[j]);
+            }
+            free(shard_filename);
+            free(shards->tables);
+            free(shards);
+            catalog_close(catalog);
+            return NULL;
+        }
+    }
+    free(shard_filename);
+    shards->cursors = malloc(sizeof(Cursor) * num_shards * SHARD_MAX_CURSORS);
+    for (uint32_t i = 0; i < SHARD_MAX_CURSORS; i++) {
+        atomic_init(&shards->cursor_slots[i], false);
+    }
+
+    Table *table = malloc(sizeof(Table));
+    table->root_page_num = 0;
+    table->pager = NULL;
+    table->cow = NULL;
+    table->shards = shards;
+    table->flusher = NULL;
+    table->catalog = catalog;
+    // Every shard was created with the same flags
+    table->hash = shards->tables[0]->hash;
+    table->memtable = NULL;// Each shard buffers its own inserts
+    pthread_rwlock_init(&table->tree_latch, NULL);
+    return table;
+}
+
+bool shard_close(Table *table) {
+    ShardSet *shards = table->shards;
+    bool success = true;
+    for (uint32_t i = 0; i < shards->num_shards; i++) {
+        success &= db_close(shards->tables[i]);
+    }
+    free(shards->cursors);
+    free(shards->tables);
+    free(shards);
+    catalog_close(table->catalog);
+    pthread_rwlock_destroy(&table->tree_latch);
+    free(table);
+    return success;
+}
+
+uint32_t shard_for_key(const ShardSet *shards, uint32_t key) {
+    // Fibonacci hashing, so runs of sequential ids spread over every shard
+    const uint32_t hash = key * 2654435761u;
+    return (uint32_t) (((uint64_t) hash * shards->num_shards) >> 32);
+}
+
+ExecuteResult shard_execute_insert(const Statement *statement, Table *table) {
+    ShardSet *shards = table->shards;
+    return execute_insert(statement, shards->tables[shard_for_key(shards, statement->row_to_insert.id)]);
+}
+
+void shard_table_start(Table *table, Cursor *cursor) {
+    ShardSet *shards = table->shards;
+    cursor->table = table;
+    cursor->shard_cursors = shard_claim_cursors(shards);
+    cursor->merges_memtable = false;
+    cursor->descending = false;
+    for (uint32_t i = 0; i < shards->num_shards; i++) {
+        table_start(shards->tables[i], &cursor->shard_cursors[i]);
+    }
+    shard_pick(cursor);
+}
+
+void shard_table_end(Table *table, Cursor *cursor) {
+    ShardSet *shards = table->shards;
+    cursor->table = table;
+    cursor->shard_cursors = shard_claim_cursors(shards);
+    cursor->merges_memtable = false;
+    cursor->descending = true;
+    for (uint32_t i = 0; i < shards->num_shards; i++) {
+        table_end(shards->tables[i], &cursor->shard_cursors[i]);
+    }
+    shard_pick(cursor);
+}
+
+// Takes a free slot of per-shard cursors, waiting like cow_pin while every slot is open
+Cursor *shard_claim_cursors(ShardSet *shards) {
+    while (true) {
+        for (uint32_t slot = 0; slot < SHARD_MAX_CURSORS; slot++) {
+            bool expected = false;
+            if (atomic_compare_exchange_strong(&shards->cursor_slots[slot], &expected, true)) {
+                return &shards->cursors[slot * shards->num_shards];
+            }
+        }
+        sched_yield();
+    }
+}
+
+// Points the merged cursor at the shard holding the smallest key, or the largest when descending;
+// ids are unique across shards
+void shard_pick(Cursor *cursor) {
+    const uint32_t num_shards = cursor->table->shards->num_shards;
+    cursor->end_of_table = true;
+    uint32_t best_key = 0;
+    for (uint32_t i = 0; i < num_shards; i++) {
+        Cursor *shard_cursor = &cursor->shard_cursors[i];
+        if (shard_cursor->end_of_table) {
+            continue;
+        }
+        const uint32_t key = cursor_key(shard_cursor);
+        if (cursor->end_of_table || (cursor->descending ? key > best_key : key < best_key)) {
+            best_key = key;
+            cursor->current_shard = i;
+            cursor->end_of_table = false;
+        }
+    }
+}
+
+void shard_cursor_advance(Cursor *cursor) {
+    cursor_advance(&cursor->shard_cursors[cursor->current_shard]);
+    shard_pick(cursor);
+}
+
+void shard_cursor_retreat(Cursor *cursor) {
+    cursor_retreat(&cursor->shard_cursors[cursor->current_shard]);
+    shard_pick(cursor);
+}
+
+void shard_cursor_close(Cursor *cursor) {
+    ShardSet *shards = cursor->table->shards;
+    for (uint32_t i = 0; i < shards->num_shards; i++) {
+        cursor_close(&cursor->shard_cursors[i]);
+    }
+    const uint32_t slot = (uint32_t) (cursor->shard_cursors - shards->cursors) / shards->num_shards;
+    atomic_store(&shards->cursor_slots[slot], false);
+}
@@ -0,0 +1,384 @@
+#include "../inc/simple_db.h"
+#include "../inc/command.h"
+#include "../inc/vacuum.h"
+
+struct SimpleDb {
+    Table *table;
+    Schema users;// Column accessors read users rows through it
+};
+
+struct SimpleDbStmt {
+    SimpleDb *db;
+    Statement statement;
+    uint32_t bound;// Bit i set once parameter i + 1 has a value
+    Cursor cursor;
+    bool cursor_open;// While a select is being stepped
+    uint32_t returned;// Rows stepped so far, for limit
+    bool done;
+    Row row;
+    const Schema *schema;// Of the current row; NULL when the statement is not on one
+    uint8_t record[SCHEMA_RECORD_MAX_SIZE];
+    char text[SCHEMA_LINE_SIZE];// The last column read as text
+};
+
+SimpleDbResult simple_db_execute_result(ExecuteResult result);
+
+SimpleDbResult simple_db_bound_record(SimpleDbStmt *stmt, uint32_t index, CodecResult result);
+
+SimpleDbResult simple_db_open(const char *filename, uint32_t flags, SimpleDb **db) {
+    *db = NULL;
+    Table *table = db_open(filename, flags);
+    if (table == NULL) {
+        return SIMPLE_DB_CANT_OPEN;
+    }
+
+    *db = malloc(sizeof(SimpleDb));
+    (*db)->table = table;
+    schema_users(&(*db)->users);
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_close(SimpleDb *db) {
+    const bool success = db_close(db->table);
+    free(db);
+    return success ? SIMPLE_DB_OK : SIMPLE_DB_IO_ERROR;
+}
+
+SimpleDbResult simple_db_vacuum(SimpleDb *db, uint32_t fill_percent) {
+    if (fill_percent < 1 || fill_percent > 100) {
+        return SIMPLE_DB_RANGE;
+    }
+    switch (table_vacuum(db->table, fill_percent)) {
+        case VACUUM_SUCCESS:
+            return SIMPLE_DB_OK;
+        case VACUUM_HASH_TABLE:
+            return SIMPLE_DB_UNORDERED;
+        case VACUUM_SNAPSHOT_OPEN:
+            return SIMPLE_DB_BUSY;
+        case VACUUM_TOO_LARGE:
+            return SIMPLE_DB_TABLE_FULL;
+        case VACUUM_IO_ERROR:
+            return SIMPLE_DB_IO_ERROR;
+    }
+    return SIMPLE_DB_IO_ERROR;
+}
+
+SimpleDbResult simple_db_prepare(SimpleDb *db, const char *sql, SimpleDbStmt **stmt) {
+    *stmt = NULL;
+
+    // prepare_statement tokenizes in place
+    InputBuffer input_buffer;
+    input_buffer.buffer = strdup(sql);
+    input_buffer.buffer_length = strlen(sql);
+    input_buffer.input_length = (ssize_t) input_buffer.buffer_length;
+
+    Statement statement;
+    const PrepareResult result = prepare_statement(&input_buffer, db->table, &statement);
+    free(input_buffer.buffer);
+    switch (result) {
+        case PREPARE_SUCCESS:
+            break;
+        case PREPARE_UNRECOGNIZED_STATEMENT:
+            return SIMPLE_DB_UNRECOGNIZED_STATEMENT;
+        case PREPARE_SYNTAX_ERROR:
+            return SIMPLE_DB_SYNTAX_ERROR;
+        case PREPARE_STRING_TOO_LONG:
+            return SIMPLE_DB_STRING_TOO_LONG;
+        case PREPARE_NEGATIVE_ID:
+            return SIMPLE_DB_NEGATIVE_ID;
+        case PREPARE_ROW_TOO_WIDE:
+            return SIMPLE_DB_ROW_TOO_WIDE;
+    }
+
+    *stmt = malloc(sizeof(SimpleDbStmt));
+    (*stmt)->db = db;
+    (*stmt)->statement = statement;
+    (*stmt)->bound = 0;
+    (*stmt)->cursor_open = false;
+    (*stmt)->returned = 0;
+    (*stmt)->done = false;
+    (*stmt)->schema = NULL;
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_bind_int(SimpleDbStmt *stmt, uint32_t index, int64_t value) {
+    if (index == 0 || index > stmt->statement.num_params) {
+        return SIMPLE_DB_RANGE;
+    }
+    if (stmt->statement.has_record) {
+        const uint32_t column = stmt->statement.record_params[index - 1];
+        return simple_db_bound_record(
+                stmt, index, schema_bind_int(stmt->db->table->catalog->schema, column, value, stmt->statement.record));
+    }
+    if (stmt->statement.params[index - 1] != COLUMN_ID) {
+        return SIMPLE_DB_RANGE;
+    }
+    if (value < 0) {
+        return SIMPLE_DB_NEGATIVE_ID;
+    }
+    if (value > UINT32_MAX) {
+        return SIMPLE_DB_RANGE;
+    }
+
+    stmt->statement.row_to_insert.id = (uint32_t) value;
+    stmt->bound |= 1u << (index - 1);
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_bind_text(SimpleDbStmt *stmt, uint32_t index, const char *value) {
+    if (index == 0 || index > stmt->statement.num_params) {
+        return SIMPLE_DB_RANGE;
+    }
+    if (stmt->statement.has_record) {
+        const uint32_t column = stmt->statement.record_params[index - 1];
+        return simple_db_bound_record(
+                stmt, index, schema_bind_text(stmt->db->table->catalog->schema, column, value, stmt->statement.record));
+    }
+
+    Row *row = &stmt->statement.row_to_insert;
+    switch (stmt->statement.params[index - 1]) {
+        case COLUMN_USERNAME:
+            if (strlen(value) > COLUMN_USERNAME_SIZE) {
+                return SIMPLE_DB_STRING_TOO_LONG;
+            }
+            strcpy(row->username, value);
+            break;
+        case COLUMN_EMAIL:
+            if (strlen(value) > COLUMN_EMAIL_SIZE) {
+                return SIMPLE_DB_STRING_TOO_LONG;
+            }
+            strcpy(row->email, value);
+            break;
+        case COLUMN_ID:
+            return SIMPLE_DB_RANGE;
+    }
+    stmt->bound |= 1u << (index - 1);
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_bind_double(SimpleDbStmt *stmt, uint32_t index, double value) {
+    // Users rows have no floating point column
+    if (index == 0 || index > stmt->statement.num_params || !stmt->statement.has_record) {
+        return SIMPLE_DB_RANGE;
+    }
+    const uint32_t column = stmt->statement.record_params[index - 1];
+    return simple_db_bound_record(
+            stmt, index, schema_bind_double(stmt->db->table->catalog->schema, column, value, stmt->statement.record));
+}
+
+// After the codec has encoded parameter index into a created table's record
+SimpleDbResult simple_db_bound_record(SimpleDbStmt *stmt, uint32_t index, CodecResult result) {
+    // A failed bind leaves the slot zeroed, so the parameter needs binding again
+    stmt->bound &= ~(1u << (index - 1));
+    switch (result) {
+        case CODEC_OK:
+            break;
+        case CODEC_INVALID:
+            return SIMPLE_DB_RANGE;
+        case CODEC_TOO_LONG:
+            return SIMPLE_DB_STRING_TOO_LONG;
+    }
+    if (stmt->statement.record_params[index - 1] == 0) {
+        const int32_t key = schema_record_key(stmt->statement.record);
+        if (key < 0) {
+            return SIMPLE_DB_NEGATIVE_ID;
+        }
+        stmt->statement.row_to_insert.id = (uint32_t) key;
+    }
+    stmt->bound |= 1u << (index - 1);
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_step(SimpleDbStmt *stmt, const Row **row) {
+    *row = NULL;
+    stmt->schema = NULL;
+    if (stmt->done) {
+        return SIMPLE_DB_DONE;
+    }
+
+    Table *table = stmt->db->table;
+    if (table_io_error(table) != 0) {
+        // Rows read after the failure could come from the pager's scratch leaf
+        simple_db_reset(stmt);
+        stmt->done = true;
+        return SIMPLE_DB_IO_ERROR;
+    }
+    switch (stmt->statement.type) {
+        case STATEMENT_INSERT:
+            if (stmt->bound != (1u << stmt->statement.num_params) - 1) {
+                return SIMPLE_DB_UNBOUND;
+            }
+            stmt->done = true;
+            return simple_db_execute_result(execute_statement(&stmt->statement, table));
+        case STATEMENT_CREATE_TABLE:
+            stmt->done = true;
+            return simple_db_execute_result(execute_statement(&stmt->statement, table));
+        case STATEMENT_SELECT:
+            if (stmt->statement.has_filter && table->catalog->schema != NULL) {
+                stmt->done = true;
+                return SIMPLE_DB_SCHEMA;
+            }
+            if (!stmt->cursor_open && stmt->statement.has_where_id) {
+                const uint32_t id = stmt->statement.where_id;
+                table_find(table, id, &stmt->cursor);
+                stmt->cursor.end_of_table = !cursor_holds_key(&stmt->cursor, id);
+            } else if (!stmt->cursor_open && stmt->statement.order_desc) {
+                if (table->hash) {
+                    stmt->done = true;
+                    return SIMPLE_DB_UNORDERED;
+                }
+                table_end(table, &stmt->cursor);
+            } else if (!stmt->cursor_open) {
+                table_start(table, &stmt->cursor);
+            }
+            stmt->cursor_open = true;
+            // Rows the filter rejects are skipped in the page, without deserialize_row
+            while (!stmt->cursor.end_of_table && !statement_matches(&stmt->statement, cursor_value(&stmt->cursor))) {
+                if (stmt->statement.order_desc) {
+                    cursor_retreat(&stmt->cursor);
+                } else {
+                    cursor_advance(&stmt->cursor);
+                }
+            }
+            if (stmt->cursor.end_of_table || stmt->returned == stmt->statement.limit) {
+                cursor_close(&stmt->cursor);
+                stmt->cursor_open = false;
+                stmt->done = true;
+                // A leaf that could not be read looks like the end of the table
+                return table_io_error(table) != 0 ? SIMPLE_DB_IO_ERROR : SIMPLE_DB_DONE;
+            }
+            memcpy(stmt->record, cursor_value(&stmt->cursor), ROW_SIZE);
+            if (stmt->statement.has_where_id) {
+                // Ids are unique, so there is no second row
+                stmt->cursor.end_of_table = true;
+            } else if (stmt->statement.order_desc) {
+                cursor_retreat(&stmt->cursor);
+            } else {
+                cursor_advance(&stmt->cursor);
+            }
+            stmt->returned++;
+            if (table->catalog->schema != NULL) {
+                stmt->schema = table->catalog->schema;
+            } else {
+                deserialize_row(stmt->record, &stmt->row);
+                stmt->schema = &stmt->db->users;
+                *row = &stmt->row;
+            }
+            return SIMPLE_DB_ROW;
+    }
+    return SIMPLE_DB_DONE;
+}
+
+uint32_t simple_db_column_count(const SimpleDbStmt *stmt) {
+    return stmt->schema == NULL ? 0 : stmt->schema->num_columns;
+}
+
+SimpleDbResult simple_db_column_int(const SimpleDbStmt *stmt, uint32_t column, int64_t *value) {
+    if (column >= simple_db_column_count(stmt)) {
+        return SIMPLE_DB_RANGE;
+    }
+    if (column == 0) {
+        // Users ids go up to UINT32_MAX; keys of created tables are never negative
+        uint32_t key;
+        memcpy(&key, stmt->record, sizeof(uint32_t));
+        *value = key;
+        return SIMPLE_DB_OK;
+    }
+    return schema_column_int(stmt->schema, stmt->record, column, value) == CODEC_OK ? SIMPLE_DB_OK : SIMPLE_DB_RANGE;
+}
+
+SimpleDbResult simple_db_column_double(const SimpleDbStmt *stmt, uint32_t column, double *value) {
+    if (column >= simple_db_column_count(stmt)) {
+        return SIMPLE_DB_RANGE;
+    }
+    return schema_column_double(stmt->schema, stmt->record, column, value) == CODEC_OK ? SIMPLE_DB_OK
+                                                                                       : SIMPLE_DB_RANGE;
+}
+
+SimpleDbResult simple_db_column_text(SimpleDbStmt *stmt, uint32_t column, const char **value) {
+    if (column >= simple_db_column_count(stmt)) {
+        return SIMPLE_DB_RANGE;
+    }
+    schema_column_text(stmt->schema, stmt->record, column, stmt->text);
+    *value = stmt->text;
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_execute_result(ExecuteResult result) {
+    switch (result) {
+        case EXECUTE_SUCCESS:
+            return SIMPLE_DB_DONE;
+        case EXECUTE_DUPLICATE_KEY:
+            return SIMPLE_DB_DUPLICATE_KEY;
+        case EXECUTE_TABLE_FULL:
+            return SIMPLE_DB_TABLE_FULL;
+        case EXECUTE_TABLE_EXISTS:
+            return SIMPLE_DB_TABLE_EXISTS;
+        case EXECUTE_IO_ERROR:
+            return SIMPLE_DB_IO_ERROR;
+        case EXECUTE_UNORDERED:
+            return SIMPLE_DB_UNORDERED;
+        case EXECUTE_SCHEMA:
+            return SIMPLE_DB_SCHEMA;
+    }
+    return SIMPLE_DB_DONE;
+}
+
+SimpleDbResult simple_db_reset(SimpleDbStmt *stmt) {
+    if (stmt->cursor_open) {
+        cursor_close(&stmt->cursor);
+        stmt->cursor_open = false;
+    }
+    stmt->returned = 0;
+    stmt->done = false;
+    stmt->schema = NULL;
+    return SIMPLE_DB_OK;
+}
+
+SimpleDbResult simple_db_finalize(SimpleDbStmt *stmt) {
+    simple_db_reset(stmt);
+    free(stmt);
+    return SIMPLE_DB_OK;
+}
+
+const char *simple_db_result_message(SimpleDbResult result) {
+    switch (result) {
+        case SIMPLE_DB_OK:
+            return "ok";
+        case SIMPLE_DB_ROW:
+            return "row available";
+        case SIMPLE_DB_DONE:
+            return "statement finished";
+        case SIMPLE_DB_CANT_OPEN:
+            return "unable to open file";
+        case SIMPLE_DB_IO_ERROR:
+            return "I/O error on the db file";
+        case SIMPLE_DB_SYNTAX_ERROR:
+            return "syntax error";
+        case SIMPLE_DB_UNRECOGNIZED_STATEMENT:
+            return "unrecognized statement";
+        case SIMPLE_DB_STRING_TOO_LONG:
+            return "string is too long";
+        case SIMPLE_DB_NEGATIVE_ID:
+            return "negative id";
+        case SIMPLE_DB_DUPLICATE_KEY:
+            return "duplicate key";
+        case SIMPLE_DB_TABLE_FULL:
+            return "table full";
+        case SIMPLE_DB_RANGE:
+            return "parameter or column index out of range, or wrong type";
+        case SIMPLE_DB_UNBOUND:
+            return "parameter not bound";
+        case SIMPLE_DB_ROW_TOO_WIDE:
+            return "row is too wide";
+        case SIMPLE_DB_TABLE_EXISTS:
+            return "table already exists";
+        case SIMPLE_DB_SCHEMA:
+            return "only users rows have username and email columns";
+        case SIMPLE_DB_UNORDERED:
+            return "hash tables have no key order";
+        case SIMPLE_DB_BUSY:
+            return "a snapshot is open";
+    }
+    return "unknown result";
+}
@@ -1,37 +1,55 @@
 #include "../inc/store.h"
+#include "../inc/shard.h"
+#include "../inc/profile.h"
+#include "../inc/flusher.h"
+#include "../inc/warm.h"
+#include "../inc/schema.h"
+#include "../inc/hash.h"
+#include "../inc/memtable.h"
 
-Cursor *leaf_node_find(const Table *table, uint32_t page_num, uint32_t key);
-
-void *leaf_node_cell(void *node, uint32_t cell_num);
-
-void initialize_internal_node(void *node);
-
-void initialize_leaf_node(void *node);
+void leaf_node_find(const Table *table, uint32_t page_num, uint32_t key, Cursor *cursor);
 
 void leaf_node_split_and_insert(const Cursor *cursor, uint32_t key, const void *value);
 
-void pager_flush(const Pager *pager, uint32_t page_num);
-
-void set_node_root(void *node, bool is_root);
-
 void set_node_type(void *node, NodeType type);
 
-uint32_t get_node_max_key(void *node);
+uint32_t get_node_max_key(Pager *pager, void *node);
+
+uint32_t snapshot_leaf_before(Pager *pager, uint32_t root_page_num, uint32_t key);
 
 /*
- * Until we start recycling free pages, new pages will always go onto the end of the database file
+ * New pages go onto the end of the database file, except in copy-on-write mode, which recycles
+ * pages that no published version can reach any more
  */
-uint32_t get_unused_page_num(const Pager *pager);
+uint32_t get_unused_page_num(const Table *table);
 
 bool is_node_root(void *node);
 
 void create_new_root(Table *table, uint32_t right_child_page_num);
 
-Cursor *internal_node_find(const Table *table, uint32_t page_num, uint32_t key);
+void internal_node_find(const Table *table, uint32_t page_num, uint32_t key, CursorLatch latch, Cursor *cursor);
+
+void table_descend(Table *table, uint32_t root_page_num, uint32_t key, CursorLatch latch, Cursor *cursor);
+
+CowState *cow_open(void);
+
+uint32_t cow_pin(CowState *cow, uint64_t *version);
+
+uint32_t cow_copy_path(Table *table, uint32_t key);
+
+void cow_commit(Table *table);
 
-uint32_t *leaf_node_next_leaf(void *node);
+void cow_checkpoint(Table *table);
 
-uint32_t *node_parent(void *node);
+void cow_reclaim(Table *table);
+
+void cow_mark_reachable(Pager *pager, uint32_t page_num, uint32_t height, bool *reachable);
+
+void relink_subtree(Pager *pager, uint32_t page_num, uint32_t parent_page_num, uint32_t *prev_leaf);
+
+void set_node_parent(const Table *table, uint32_t page_num, uint32_t parent_page_num);
+
+bool btree_upgrade(Pager *pager);
 
 void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key);
 
@@ -41,6 +59,8 @@ void internal_node_insert(const Table *table, uint32_t parent_page_num, uint32_t
 
 void internal_node_split_and_insert(const Table *table, uint32_t parent_page_num, uint32_t child_page_num);
 
+void measure_subtree(Pager *pager, uint32_t page_num, uint32_t depth, CursorLatch latch, TableStats *stats);
+
 /*
  * Row Layout
  */
@@ -77,7 +97,12 @@ const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_PREV_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_PREV_LEAF_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE =
+        COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_PREV_LEAF_SIZE;
+const uint32_t LEGACY_LEAF_NODE_HEADER_SIZE = LEAF_NODE_PREV_LEAF_OFFSET;
+const uint32_t BTREE_FORMAT_MAGIC = 0x324b4e4c;// "LNK2"
 
 /*
  * Leaf Node Body Layout
@@ -108,8 +133,11 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE =
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-// keep this small for testing
-const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
+// keep this small for testing; benchmarks build with full-page internal nodes
+#ifndef INTERNAL_NODE_MAX_KEYS
+#define INTERNAL_NODE_MAX_KEYS 3
+#endif
+const uint32_t INTERNAL_NODE_MAX_CELLS = INTERNAL_NODE_MAX_KEYS;
 
 void serialize_row(const Row *source, void *destination) {
     memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
@@ -124,106 +152,379 @@ void deserialize_row(const void *source, Row *destination) {
 }
 
 void *get_page(Pager *pager, uint32_t page_num) {
+    pthread_mutex_lock(&pager->lock);
     if (page_num >= TABLE_MAX_PAGES) {
-        printf("page_num out of range");
-        exit(EXIT_FAILURE);
+        // Inserts check table_can_insert first, so only a corrupt file gets here
+        pager_fail(pager, ERANGE);
+        initialize_leaf_node(pager->scratch);
+        pthread_mutex_unlock(&pager->lock);
+        return pager->scratch;
     }
 
     // 当 pager 当中的缓存没有命中时， 需要向文件读取对应的 page
     if (pager->pages[page_num] == NULL) {
+        pager_count(&pager->stats.cache_misses, 1);
         void *const page = malloc(PAGE_SIZE);
 
         // 文件中一共有多少页
-        const uint32_t num_pages = pager->file_length / PAGE_SIZE;
+        const uint64_t num_pages = pager->file_length / PAGE_SIZE;
 
         if (page_num < num_pages) {
             // 如果命中db文件中存在的Page, 则读取文件中对应的Page
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            const ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
+            const uint64_t io_start = profile_start();
+            struct iovec iov = {.iov_base = page, .iov_len = PAGE_SIZE};
+            IoRequest request = {.iov = &iov, .iovcnt = 1, .offset = (uint64_t) page_num * PAGE_SIZE};
+            io_submit(pager->io, IO_READ, &request, 1);
+            profile_record(PROFILE_PAGE_IO, io_start);
+            if (request.result < 0) {
+                // The frame stays empty, so nothing half-read is ever written back
+                free(page);
+                pager_fail(pager, (int) -request.result);
+                initialize_leaf_node(pager->scratch);
+                pthread_mutex_unlock(&pager->lock);
+                return pager->scratch;
             }
+            pager_count(&pager->stats.pages_read, 1);
+            pager_count(&pager->stats.bytes_read, request.result);
         } else {
             // 如果申请了超出db文件以外的页数, 则将超出部分全部作为空白页
             pager->num_pages = page_num + 1;
+            // The file has nothing for this page yet, so it must be written even if never modified
+            pager_mark_dirty(pager, page_num);
         }
 
         pager->pages[page_num] = page;
+    } else {
+        pager_count(&pager->stats.cache_hits, 1);
     }
-    return pager->pages[page_num];
+    // Recency for the warm set, only as fine as the flusher's passes
+    pager->touched[page_num] = atomic_load_explicit(&pager->flush_epoch, memory_order_relaxed);
+    // Frames are never evicted, so the pointer stays valid after the lock is dropped
+    void *page = pager->pages[page_num];
+    pthread_mutex_unlock(&pager->lock);
+    return page;
+}
+
+void pager_fail(Pager *pager, int error) {
+    int healthy = 0;
+    atomic_compare_exchange_strong(&pager->error, &healthy, error);
 }
 
-Pager *pager_open(const char *filename) {
+int table_io_error(const Table *table) {
+    if (table->shards != NULL) {
+        for (uint32_t i = 0; i < table->shards->num_shards; i++) {
+            const int error = table_io_error(table->shards->tables[i]);
+            if (error != 0) {
+                return error;
+            }
+        }
+        return 0;
+    }
+    return atomic_load(&table->pager->error);
+}
+
+/*
+ * glibc prefers readers by default, so back-to-back scans could keep a writer waiting for the
+ * exclusive latch forever. Preferring writers deadlocks a thread that takes the latch shared twice,
+ * which no caller does.
+ */
+void latch_init_prefer_writer(pthread_rwlock_t *latch) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(latch, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+void pager_latch(Pager *pager, uint32_t page_num, CursorLatch latch) {
+    if (page_num >= TABLE_MAX_PAGES) {
+        // get_page hands out the scratch leaf, which no latch covers
+        return;
+    }
+    switch (latch) {
+        case CURSOR_LATCH_SHARED:
+            pthread_rwlock_rdlock(&pager->latches[page_num]);
+            break;
+        case CURSOR_LATCH_EXCLUSIVE:
+            pthread_rwlock_wrlock(&pager->latches[page_num]);
+            break;
+        case CURSOR_LATCH_TREE:
+            // The exclusive tree latch already keeps every other thread out
+            break;
+        case CURSOR_LATCH_SNAPSHOT:
+        case CURSOR_LATCH_COW_WRITER:
+            // Published pages are immutable in copy-on-write mode
+            break;
+    }
+}
+
+void pager_unlatch(Pager *pager, uint32_t page_num, CursorLatch latch) {
+    if (page_num < TABLE_MAX_PAGES && (latch == CURSOR_LATCH_SHARED || latch == CURSOR_LATCH_EXCLUSIVE)) {
+        pthread_rwlock_unlock(&pager->latches[page_num]);
+    }
+}
+
+Pager *pager_open(const char *filename, IoKind io_kind) {
     const int fd = open(filename, O_RDWR |         // Read/Write mode
                                           +O_CREAT,// Create file if it does not exist
                         +S_IWUSR |                 // User write permission
                                 +S_IRUSR           // User read permission
     );
     if (fd == -1) {
-        printf("Unable to open file\n");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
-    const off_t file_length = lseek(fd, 0, SEEK_END);
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        close(fd);
+        return NULL;
+    }
+    const uint64_t file_length = (uint64_t) file_stat.st_size;
+    if (file_length / PAGE_SIZE > TABLE_MAX_PAGES) {
+        // Every page of the file needs a frame slot
+        close(fd);
+        return NULL;
+    }
 
     Pager *pager = malloc(sizeof(Pager));
     pager->file_descriptor = fd;
+    pager->io = io_open(fd, io_kind);
+    pager->filename = strdup(filename);
     pager->file_length = file_length;
-    pager->num_pages = file_length / PAGE_SIZE;
-
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
+    pager->num_pages = (uint32_t) (file_length / PAGE_SIZE);
+    memset(&pager->stats, 0, sizeof(PagerStats));
+    atomic_init(&pager->flush_epoch, 1);
+    atomic_init(&pager->error, 0);
+    pager->scratch = malloc(PAGE_SIZE);
+    pthread_mutex_init(&pager->lock, NULL);
+
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
         pager->pages[i] = NULL;
+        pager->touched[i] = 0;
+        atomic_init(&pager->dirty[i], 0);
+        pthread_rwlock_init(&pager->latches[i], NULL);
     }
 
     return pager;
 }
 
-Table *db_open(const char *filename) {
-    Pager *pager = pager_open(filename);
+Table *db_open(const char *filename, uint32_t flags) {
+    if (DB_OPEN_SHARD_COUNT(flags) > 1 || shard_manifest_count(filename) > 0) {
+        return shard_open(filename, flags);
+    }
+
+    Catalog *catalog = catalog_open(filename);
+    if (catalog == NULL) {
+        return NULL;
+    }
+    Pager *pager = pager_open(filename, (flags & DB_OPEN_IO_URING) ? IO_URING : IO_SYSCALL);
+    if (pager == NULL) {
+        catalog_close(catalog);
+        return NULL;
+    }
+
+    // Before anything fetches a frame: btree_upgrade rewrites the legacy leaves it reads in place
+    warm_set_load(pager);
+
+    // The file decides: a hash file opens as one without the flag, but a B+tree file can't become one
+    const bool hash = pager->num_pages == 0 ? (flags & DB_OPEN_HASH) != 0 : hash_file_check(pager);
+    const uint32_t memtable_rows = DB_OPEN_MEMTABLE_ROWS(flags);
+    if ((pager->num_pages > 0 && (flags & DB_OPEN_HASH) && !hash) || (hash && (flags & DB_OPEN_COW)) ||
+        (memtable_rows > 0 && (hash || (flags & DB_OPEN_COW))) ||
+        (pager->num_pages > 0 && !hash && !btree_upgrade(pager))) {
+        pager_close(pager, false);
+        catalog_close(catalog);
+        return NULL;
+    }
 
     Table *table = malloc(sizeof(Table));
     table->pager = pager;
+    table->catalog = catalog;
+    table->hash = hash;
     table->root_page_num = 0;
-
-    if (pager->num_pages == 0) {
+    table->cow = (flags & DB_OPEN_COW) ? cow_open() : NULL;
+    table->shards = NULL;
+    table->memtable = memtable_rows > 0 ? memtable_open(memtable_rows) : NULL;
+    latch_init_prefer_writer(&table->tree_latch);
+
+    if (pager->num_pages == 0 && hash) {
+        hash_init(pager);
+    } else if (pager->num_pages == 0) {
         // New database file
         void *root_node = get_page(pager, 0);
         initialize_leaf_node(root_node);
         set_node_root(root_node, true);
+        *root_node_format(root_node) = BTREE_FORMAT_MAGIC;
+    } else if (table->cow != NULL) {
+        cow_reclaim(table);
     }
+    flusher_start(table);
 
     return table;
 }
 
-void db_close(Table *table) {
+/*
+ * Files written before leaves had a prev link carry no format marker, and their leaves keep the cells
+ * right after a 14-byte header. Walks the leaf chain from the left-most leaf, moving each leaf's cells
+ * up to the current header and linking it back to the one before, then marks page 0. The whole chain
+ * is checked before anything changes; a file that is neither format is refused.
+ */
+bool btree_upgrade(Pager *pager) {
+    // Read past the cache, like hash_file_check, so opening a current file leaves the counters alone
+    uint32_t format;
+    if (pread(pager->file_descriptor, &format, sizeof(format), PARENT_POINTER_OFFSET) == (ssize_t) sizeof(format) &&
+        format == BTREE_FORMAT_MAGIC) {
+        return true;
+    }
+    void *root = get_page(pager, 0);
+
+    uint32_t first_leaf = 0;
+    void *node = root;
+    for (uint32_t depth = 1; get_node_type(node) == NODE_INTERNAL; depth++) {
+        const uint32_t num_keys = *internal_node_num_keys(node);
+        if (depth == BTREE_MAX_HEIGHT || num_keys == 0 || num_keys > INTERNAL_NODE_MAX_CELLS ||
+            *internal_node_child(node, 0) >= pager->num_pages) {
+            return false;
+        }
+        first_leaf = *internal_node_child(node, 0);
+        node = get_page(pager, first_leaf);
+    }
+
+    uint32_t num_leaves = 0;
+    for (uint32_t page_num = first_leaf;; num_leaves++) {
+        node = get_page(pager, page_num);
+        if (num_leaves == pager->num_pages || get_node_type(node) != NODE_LEAF ||
+            *leaf_node_num_cells(node) > LEAF_NODE_MAX_CELLS || *leaf_node_next_leaf(node) >= pager->num_pages) {
+            return false;
+        }
+        page_num = *leaf_node_next_leaf(node);
+        if (page_num == 0) {
+            break;
+        }
+    }
+    if (atomic_load(&pager->error) != 0) {
+        // Some of the chain came from the scratch leaf
+        return false;
+    }
+
+    uint32_t prev_page_num = 0;
+    for (uint32_t page_num = first_leaf;;) {
+        node = get_page(pager, page_num);
+        memmove(node + LEAF_NODE_HEADER_SIZE, node + LEGACY_LEAF_NODE_HEADER_SIZE,
+                (size_t) *leaf_node_num_cells(node) * LEAF_NODE_CELL_SIZE);
+        *leaf_node_prev_leaf(node) = prev_page_num;
+        pager_mark_dirty(pager, page_num);
+        prev_page_num = page_num;
+        page_num = *leaf_node_next_leaf(node);
+        if (page_num == 0) {
+            break;
+        }
+    }
+    *root_node_format(root) = BTREE_FORMAT_MAGIC;
+    pager_mark_dirty(pager, 0);
+    return true;
+}
+
+bool db_close(Table *table) {
+    if (table->shards != NULL) {
+        return shard_close(table);
+    }
+
+    // Whatever the flusher has not written yet is still marked dirty
+    flusher_stop(table);
     Pager *pager = table->pager;
+    bool success = true;
+
+    if (table->memtable != NULL) {
+        success &= memtable_merge(table);
+        memtable_close(table->memtable);
+    }
+    if (table->cow != NULL) {
+        cow_checkpoint(table);
+        pthread_mutex_destroy(&table->cow->writer_lock);
+        free(table->cow);
+    }
 
+    // Only a hint for the next db_open, so failing to write it does not fail the close
+    warm_set_save(pager, !table->hash);
+    success &= pager_close(pager, true);
+    catalog_close(table->catalog);
+    pthread_rwlock_destroy(&table->tree_latch);
+    free(table);
+    return success;
+}
+
+bool pager_close(Pager *pager, bool flush) {
+    bool success = !flush || pager_flush_dirty(pager);
     for (uint32_t i = 0; i < pager->num_pages; i++) {
         // 缓存没有命中过的 page， 直接跳过
         if (pager->pages[i] == NULL) {
             continue;
         }
-        pager_flush(pager, i);
         free(pager->pages[i]);
         pager->pages[i] = NULL;
     }
 
     // close file
+    io_close(pager->io);
     int result = close(pager->file_descriptor);
     if (result == -1) {
-        printf("Error closing db file\n");
-        exit(EXIT_FAILURE);
+        success = false;
+    }
+    // Rows written to the scratch leaf after a failure are lost
+    success &= atomic_load(&pager->error) == 0;
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
+        pthread_rwlock_destroy(&pager->latches[i]);
+    }
+    pthread_mutex_destroy(&pager->lock);
+    free(pager->scratch);
+    free(pager->filename);
+    free(pager);
+    return success;
+}
+
+void table_start(Table *table, Cursor *cursor) {
+    if (table->shards != NULL) {
+        shard_table_start(table, cursor);
+    } else if (table->memtable != NULL) {
+        memtable_table_start(table, cursor);
+    } else {
+        tree_start(table, cursor);
     }
-    free(table);
 }
 
-Cursor *table_start(Table *table) {
-    Cursor *cursor = table_find(table, 0);
+void tree_start(Table *table, Cursor *cursor) {
+    if (table->hash) {
+        pthread_rwlock_rdlock(&table->tree_latch);
+        hash_table_start(table, cursor);
+        return;
+    }
+
+    tree_find(table, 0, cursor);
     void *node = get_page(table->pager, cursor->page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
     cursor->end_of_table = (num_cells == 0);
+}
+
+void table_end(Table *table, Cursor *cursor) {
+    if (table->shards != NULL) {
+        shard_table_end(table, cursor);
+    } else if (table->memtable != NULL) {
+        memtable_table_end(table, cursor);
+    } else {
+        tree_end(table, cursor);
+    }
+}
 
-    return cursor;
+void tree_end(Table *table, Cursor *cursor) {
+    assert(!table->hash);
+    // Every key is <= UINT32_MAX, so this lands past the last cell of the right-most leaf, or on it
+    tree_find(table, UINT32_MAX, cursor);
+    const uint32_t num_cells = *leaf_node_num_cells(get_page(table->pager, cursor->page_num));
+    cursor->end_of_table = (num_cells == 0);
+    if (cursor->cell_num == num_cells && num_cells > 0) {
+        cursor->cell_num = num_cells - 1;
+    }
 }
 
 NodeType get_node_type(void *node) {
@@ -231,13 +532,15 @@ NodeType get_node_type(void *node) {
     return (NodeType) value;
 }
 
-Cursor *leaf_node_find(const Table *table, uint32_t page_num, uint32_t key) {
+void leaf_node_find(const Table *table, uint32_t page_num, uint32_t key, Cursor *cursor) {
     void *node = get_page(table->pager, page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
-    Cursor *cursor = malloc(sizeof(Cursor));
     cursor->table = (Table *) table;
     cursor->page_num = page_num;
+    cursor->end_of_table = false;
+    cursor->shard_cursors = NULL;
+    cursor->merges_memtable = false;
 
     // Binary search
     uint32_t left = 0;
@@ -247,7 +550,7 @@ Cursor *leaf_node_find(const Table *table, uint32_t page_num, uint32_t key) {
         uint32_t key_at_mid = *leaf_node_key(node, mid);
         if (key == key_at_mid) {
             cursor->cell_num = mid;
-            return cursor;
+            return;
         }
         if (key < key_at_mid) {
             right = mid;
@@ -256,74 +559,659 @@ Cursor *leaf_node_find(const Table *table, uint32_t page_num, uint32_t key) {
         }
     }
     cursor->cell_num = left;
-    return cursor;
 }
 
-Cursor *table_find(Table *table, uint32_t key) {
-    const uint32_t root_page_num = table->root_page_num;
+/*
+ * The caller holds the tree latch. Node types only change when the root splits, which needs
+ * the tree latch exclusive, so the type of a node can be read before latching it.
+ */
+void table_descend(Table *table, uint32_t root_page_num, uint32_t key, CursorLatch latch, Cursor *cursor) {
+    if (table->hash) {
+        hash_find(table, key, latch, cursor);
+        return;
+    }
+
     void *root_node = get_page(table->pager, root_page_num);
 
     if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
+        pager_latch(table->pager, root_page_num, latch);
+        leaf_node_find(table, root_page_num, key, cursor);
     } else {
-        return internal_node_find(table, root_page_num, key);
+        pager_latch(table->pager, root_page_num, latch == CURSOR_LATCH_EXCLUSIVE ? CURSOR_LATCH_SHARED : latch);
+        internal_node_find(table, root_page_num, key, latch, cursor);
+    }
+    cursor->latch = latch;
+    cursor->root_page_num = root_page_num;
+}
+
+void table_find(Table *table, uint32_t key, Cursor *cursor) {
+    if (table->shards != NULL) {
+        table_find(table->shards->tables[shard_for_key(table->shards, key)], key, cursor);
+    } else if (table->memtable != NULL) {
+        memtable_table_find(table, key, cursor);
+    } else {
+        tree_find(table, key, cursor);
+    }
+}
+
+void tree_find(Table *table, uint32_t key, Cursor *cursor) {
+    const uint64_t start = profile_start();
+    if (table->cow != NULL) {
+        uint64_t version;
+        const uint32_t slot = cow_pin(table->cow, &version);
+        table_descend(table, (uint32_t) version, key, CURSOR_LATCH_SNAPSHOT, cursor);
+        cursor->reader_slot = slot;
+    } else {
+        pthread_rwlock_rdlock(&table->tree_latch);
+        table_descend(table, table->root_page_num, key, CURSOR_LATCH_SHARED, cursor);
+    }
+    profile_record(PROFILE_FIND, start);
+}
+
+void table_find_for_insert(Table *table, uint32_t key, Cursor *cursor) {
+    const uint64_t start = profile_start();
+    if (table->cow != NULL) {
+        // Nothing is copied until leaf_node_insert, so a duplicate key costs no pages
+        pthread_mutex_lock(&table->cow->writer_lock);
+        table->cow->txn = (uint32_t) (atomic_load(&table->cow->version) >> 32) + 1;
+        table_descend(table, table->root_page_num, key, CURSOR_LATCH_COW_WRITER, cursor);
+        profile_record(PROFILE_FIND, start);
+        return;
+    }
+
+    // Optimistic pass: internal nodes shared, only the leaf exclusive
+    pthread_rwlock_rdlock(&table->tree_latch);
+    table_descend(table, table->root_page_num, key, CURSOR_LATCH_EXCLUSIVE, cursor);
+    void *leaf = get_page(table->pager, cursor->page_num);
+    const bool has_room = table->hash ? *hash_bucket_num_cells(leaf) < HASH_BUCKET_MAX_CELLS
+                                      : *leaf_node_num_cells(leaf) < LEAF_NODE_MAX_CELLS;
+    if (has_room) {
+        profile_record(PROFILE_FIND, start);
+        return;
+    }
+    cursor_close(cursor);
+
+    /*
+     * The leaf will split. The split path rewrites ancestors and reads siblings
+     * (internal_node_insert looks at the parent's right child), so it cannot be covered
+     * by path latches alone; take the whole tree instead.
+     */
+    pthread_rwlock_wrlock(&table->tree_latch);
+    table_descend(table, table->root_page_num, key, CURSOR_LATCH_TREE, cursor);
+    profile_record(PROFILE_FIND, start);
+}
+
+bool cursor_holds_key(Cursor *cursor, uint32_t key) {
+    if (cursor->merges_memtable && cursor->memtable_node != NULL && cursor->memtable_node->key == key) {
+        return true;
+    }
+    void *node = get_page(cursor->table->pager, cursor->page_num);
+    if (cursor->table->hash) {
+        return cursor->cell_num < *hash_bucket_num_cells(node) && *hash_bucket_key(node, cursor->cell_num) == key;
+    }
+    return cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == key;
+}
+
+void cursor_close(Cursor *cursor) {
+    if (cursor->shard_cursors != NULL) {
+        shard_cursor_close(cursor);
+        return;
+    }
+    if (cursor->merges_memtable) {
+        memtable_cursor_close(cursor);
+        return;
+    }
+
+    Table *table = cursor->table;
+    switch (cursor->latch) {
+        case CURSOR_LATCH_SNAPSHOT:
+            atomic_store(&table->cow->readers[cursor->reader_slot], 0);
+            break;
+        case CURSOR_LATCH_COW_WRITER:
+            cow_commit(table);
+            pthread_mutex_unlock(&table->cow->writer_lock);
+            break;
+        default:
+            pager_unlatch(table->pager, cursor->page_num, cursor->latch);
+            pthread_rwlock_unlock(&table->tree_latch);
+            break;
+    }
+}
+
+CowState *cow_open(void) {
+    CowState *cow = malloc(sizeof(CowState));
+    pthread_mutex_init(&cow->writer_lock, NULL);
+    // Version 1 is whatever the file holds; its root is always page 0
+    atomic_init(&cow->version, (uint64_t) 1 << 32);
+    for (uint32_t i = 0; i < COW_MAX_READERS; i++) {
+        atomic_init(&cow->readers[i], 0);
+    }
+    atomic_init(&cow->vacuuming, false);
+    cow->txn = 1;
+    memset(cow->fresh_txn, 0, sizeof(cow->fresh_txn));
+    cow->num_retired = 0;
+    cow->num_free = 0;
+    return cow;
+}
+
+/*
+ * Registers a reader and returns its slot. The version is re-read after the slot is published:
+ * a writer that reclaimed pages before seeing the slot must also have published a newer
+ * version, so the reader retries with that one. The same ordering keeps a reader off the pager
+ * table_vacuum is replacing: either vacuum sees the slot, or the reader sees the flag and backs off.
+ */
+uint32_t cow_pin(CowState *cow, uint64_t *version) {
+    while (true) {
+        for (uint32_t slot = 0; slot < COW_MAX_READERS; slot++) {
+            uint64_t pinned = atomic_load(&cow->version);
+            uint32_t expected = 0;
+            if (!atomic_compare_exchange_strong(&cow->readers[slot], &expected, (uint32_t) (pinned >> 32))) {
+                continue;
+            }
+            if (atomic_load(&cow->vacuuming)) {
+                atomic_store(&cow->readers[slot], 0);
+                while (atomic_load(&cow->vacuuming)) {
+                    sched_yield();
+                }
+                break;
+            }
+            uint64_t current = atomic_load(&cow->version);
+            while (current != pinned) {
+                pinned = current;
+                atomic_store(&cow->readers[slot], (uint32_t) (pinned >> 32));
+                current = atomic_load(&cow->version);
+            }
+            *version = pinned;
+            return slot;
+        }
+        // Every slot is taken, wait for a reader to finish
+        sched_yield();
+    }
+}
+
+/*
+ * Copies every page on the path from the working root to the leaf for key that the current
+ * transaction has not written yet, and returns the page number of the writable leaf.
+ * Parent pointers are only kept right along the copied path; nothing else reads them.
+ */
+uint32_t cow_copy_path(Table *table, uint32_t key) {
+    CowState *cow = table->cow;
+    Pager *pager = table->pager;
+    uint32_t parent_page_num = INVALIDE_PAGE_NUM;
+    uint32_t child_index = 0;
+    uint32_t page_num = table->root_page_num;
+
+    while (true) {
+        if (cow->fresh_txn[page_num] != cow->txn) {
+            const uint32_t copy_page_num = get_unused_page_num(table);
+            memcpy(get_page(pager, copy_page_num), get_page(pager, page_num), PAGE_SIZE);
+            pager_mark_dirty(pager, copy_page_num);
+            // Page 0 is where db_close puts the root back, so it is never recycled
+            if (page_num != 0) {
+                cow->retired_pages[cow->num_retired] = page_num;
+                cow->retired_txns[cow->num_retired] = cow->txn;
+                cow->num_retired++;
+            }
+            page_num = copy_page_num;
+            if (parent_page_num == INVALIDE_PAGE_NUM) {
+                table->root_page_num = page_num;
+            } else {
+                *internal_node_child(get_page(pager, parent_page_num), child_index) = page_num;
+                pager_mark_dirty(pager, parent_page_num);
+            }
+        }
+
+        void *node = get_page(pager, page_num);
+        if (parent_page_num != INVALIDE_PAGE_NUM) {
+            *node_parent(node) = parent_page_num;
+            pager_mark_dirty(pager, page_num);
+        }
+        if (get_node_type(node) == NODE_LEAF) {
+            return page_num;
+        }
+        child_index = internal_node_find_child(node, key);
+        parent_page_num = page_num;
+        page_num = *internal_node_child(node, child_index);
+    }
+}
+
+// Publishes the writer's working root and recycles pages no pinned version can reach
+void cow_commit(Table *table) {
+    CowState *cow = table->cow;
+    const uint64_t published = atomic_load(&cow->version);
+    if ((uint32_t) published == table->root_page_num) {
+        // Nothing was copied, e.g. a duplicate key
+        return;
+    }
+    atomic_store(&cow->version, (uint64_t) cow->txn << 32 | table->root_page_num);
+
+    uint32_t oldest = cow->txn;
+    for (uint32_t i = 0; i < COW_MAX_READERS; i++) {
+        const uint32_t pinned = atomic_load(&cow->readers[i]);
+        if (pinned != 0 && pinned < oldest) {
+            oldest = pinned;
+        }
+    }
+
+    // A page retired by txn T is only visible to versions older than T
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < cow->num_retired; i++) {
+        if (cow->retired_txns[i] <= oldest) {
+            cow->free_pages[cow->num_free++] = cow->retired_pages[i];
+        } else {
+            cow->retired_pages[kept] = cow->retired_pages[i];
+            cow->retired_txns[kept] = cow->retired_txns[i];
+            kept++;
+        }
+    }
+    cow->num_retired = kept;
+}
+
+/*
+ * Brings the file back to the in-place layout before it is written out: the root moves back to
+ * page 0, and parent pointers and the leaf chain, which copying leaves stale, are rebuilt.
+ * Runs at db_close when no cursor is open.
+ */
+void cow_checkpoint(Table *table) {
+    Pager *pager = table->pager;
+    if (table->root_page_num != 0) {
+        memcpy(get_page(pager, 0), get_page(pager, table->root_page_num), PAGE_SIZE);
+        pager_mark_dirty(pager, 0);
+        table->root_page_num = 0;
     }
+    uint32_t prev_leaf = INVALIDE_PAGE_NUM;
+    relink_subtree(pager, 0, INVALIDE_PAGE_NUM, &prev_leaf);
 }
-Cursor *internal_node_find(const Table *table, uint32_t page_num, uint32_t key) {
+
+/*
+ * The retired and free lists only live as long as the session, so the pages an earlier
+ * copy-on-write session superseded are still in the file but unreachable from the root.
+ * Marks every page the tree reaches and hands the rest to the free list, lowest first.
+ */
+void cow_reclaim(Table *table) {
+    Pager *pager = table->pager;
+    CowState *cow = table->cow;
+    // Every leaf is at the same depth, so only the internal nodes need to be read
+    uint32_t height = 1;
+    for (void *node = get_page(pager, 0); get_node_type(node) == NODE_INTERNAL; height++) {
+        node = get_page(pager, *internal_node_child(node, 0));
+    }
+    bool *reachable = calloc(pager->num_pages, sizeof(bool));
+    cow_mark_reachable(pager, 0, height, reachable);
+    // A node that could not be read hid its children, which must not be handed out
+    const bool complete = atomic_load(&pager->error) == 0;
+    for (uint32_t page_num = pager->num_pages - 1; complete && page_num > 0; page_num--) {
+        if (!reachable[page_num]) {
+            cow->free_pages[cow->num_free++] = page_num;
+        }
+    }
+    free(reachable);
+}
+
+void cow_mark_reachable(Pager *pager, uint32_t page_num, uint32_t height, bool *reachable) {
+    reachable[page_num] = true;
+    if (height == 1) {
+        return;
+    }
+    void *node = get_page(pager, page_num);
+    const uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        const uint32_t child_page_num = *internal_node_child(node, i);
+        if (child_page_num < pager->num_pages) {
+            cow_mark_reachable(pager, child_page_num, height - 1, reachable);
+        }
+    }
+}
+
+void relink_subtree(Pager *pager, uint32_t page_num, uint32_t parent_page_num, uint32_t *prev_leaf) {
+    void *node = get_page(pager, page_num);
+    pager_mark_dirty(pager, page_num);
+    if (parent_page_num != INVALIDE_PAGE_NUM) {
+        *node_parent(node) = parent_page_num;
+    }
+
+    if (get_node_type(node) == NODE_LEAF) {
+        if (*prev_leaf != INVALIDE_PAGE_NUM) {
+            *leaf_node_next_leaf(get_page(pager, *prev_leaf)) = page_num;
+        }
+        *leaf_node_next_leaf(node) = 0;
+        *leaf_node_prev_leaf(node) = *prev_leaf == INVALIDE_PAGE_NUM ? 0 : *prev_leaf;
+        *prev_leaf = page_num;
+        return;
+    }
+
+    const uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        relink_subtree(pager, *internal_node_child(node, i), page_num, prev_leaf);
+    }
+}
+
+// page_num is latched by the caller; its latch is handed over to the child on the way down
+void internal_node_find(const Table *table, uint32_t page_num, uint32_t key, CursorLatch latch, Cursor *cursor) {
+    const CursorLatch internal_latch = latch == CURSOR_LATCH_EXCLUSIVE ? CURSOR_LATCH_SHARED : latch;
     void *node = get_page(table->pager, page_num);
     uint32_t child_index = internal_node_find_child(node, key);
     uint32_t child_num = *internal_node_child(node, child_index);
     void *child = get_page(table->pager, child_num);
-    switch (get_node_type(child)) {
+    const NodeType child_type = get_node_type(child);
+
+    // Lookups never modify internal nodes, so the parent can go as soon as the child is held
+    pager_latch(table->pager, child_num, child_type == NODE_LEAF ? latch : internal_latch);
+    pager_unlatch(table->pager, page_num, internal_latch);
+
+    switch (child_type) {
         case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
+            leaf_node_find(table, child_num, key, cursor);
+            break;
         case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
+            internal_node_find(table, child_num, key, latch, cursor);
+            break;
     }
 }
 
-void pager_flush(const Pager *pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        printf("Tried to flush NULL page.\n");
-        exit(EXIT_FAILURE);
+bool pager_flush_dirty(Pager *pager) {
+    uint32_t *page_nums = malloc(sizeof(uint32_t) * (pager->num_pages + 1));
+    struct iovec *iov = malloc(sizeof(struct iovec) * (pager->num_pages + 1));
+    IoRequest *requests = malloc(sizeof(IoRequest) * (pager->num_pages + 1));
+    uint32_t count = 0;
+    uint32_t num_requests = 0;
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        if (pager->pages[i] == NULL || atomic_load(&pager->dirty[i]) == 0) {
+            continue;
+        }
+        iov[count] = (struct iovec) {.iov_base = pager->pages[i], .iov_len = PAGE_SIZE};
+        IoRequest *last = num_requests > 0 ? &requests[num_requests - 1] : NULL;
+        if (last != NULL && page_nums[count - 1] + 1 == i && last->iovcnt < IO_RUN_PAGES) {
+            last->iovcnt++;
+        } else {
+            requests[num_requests++] =
+                    (IoRequest) {.iov = &iov[count], .iovcnt = 1, .offset = (uint64_t) i * PAGE_SIZE};
+        }
+        page_nums[count++] = i;
+    }
+
+    bool success = io_submit(pager->io, IO_WRITE, requests, num_requests);
+    const uint32_t *page_num = page_nums;
+    for (uint32_t i = 0; i < num_requests; i++) {
+        const IoRequest *request = &requests[i];
+        if (request->result == (int64_t) request->iovcnt * PAGE_SIZE) {
+            for (uint32_t j = 0; j < request->iovcnt; j++) {
+                atomic_store(&pager->dirty[page_num[j]], 0);
+            }
+            pager_count(&pager->stats.pages_written, request->iovcnt);
+            pager_count(&pager->stats.bytes_written, request->result);
+        } else {
+            // The page stays dirty, so a later flush tries it again
+            pager_fail(pager, request->result < 0 ? (int) -request->result : EIO);
+        }
+        page_num += request->iovcnt;
+    }
+    free(requests);
+    free(iov);
+    free(page_nums);
+    return success;
+}
+
+void pager_count(_Atomic uint64_t *counter, uint64_t amount) {
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+void pager_mark_dirty(Pager *pager, uint32_t page_num) {
+    if (page_num >= TABLE_MAX_PAGES) {
+        // Writes to the scratch leaf are dropped; the pager has already failed
+        return;
     }
+    atomic_store_explicit(&pager->dirty[page_num], atomic_load_explicit(&pager->flush_epoch, memory_order_relaxed),
+                          memory_order_relaxed);
+}
 
-    const off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
+void table_stats(Table *table, TableStats *stats) {
+    memset(stats, 0, sizeof(TableStats));
+    if (table->shards != NULL) {
+        for (uint32_t i = 0; i < table->shards->num_shards; i++) {
+            TableStats shard_stats;
+            table_stats(table->shards->tables[i], &shard_stats);
+            stats->cache_hits += shard_stats.cache_hits;
+            stats->cache_misses += shard_stats.cache_misses;
+            stats->pages_read += shard_stats.pages_read;
+            stats->bytes_read += shard_stats.bytes_read;
+            stats->pages_written += shard_stats.pages_written;
+            stats->bytes_written += shard_stats.bytes_written;
+            stats->leaf_splits += shard_stats.leaf_splits;
+            stats->internal_splits += shard_stats.internal_splits;
+            if (shard_stats.tree_height > stats->tree_height) {
+                stats->tree_height = shard_stats.tree_height;
+            }
+            stats->num_pages += shard_stats.num_pages;
+            stats->leaf_pages += shard_stats.leaf_pages;
+            stats->internal_pages += shard_stats.internal_pages;
+            stats->rows += shard_stats.rows;
+            stats->memtable_rows += shard_stats.memtable_rows;
+        }
+    } else {
+        // Copy the counters before walking, so the walk's own get_page calls don't show up
+        Pager *pager = table->pager;
+        stats->cache_hits = atomic_load_explicit(&pager->stats.cache_hits, memory_order_relaxed);
+        stats->cache_misses = atomic_load_explicit(&pager->stats.cache_misses, memory_order_relaxed);
+        stats->pages_read = atomic_load_explicit(&pager->stats.pages_read, memory_order_relaxed);
+        stats->bytes_read = atomic_load_explicit(&pager->stats.bytes_read, memory_order_relaxed);
+        stats->pages_written = atomic_load_explicit(&pager->stats.pages_written, memory_order_relaxed);
+        stats->bytes_written = atomic_load_explicit(&pager->stats.bytes_written, memory_order_relaxed);
+        stats->leaf_splits = atomic_load_explicit(&pager->stats.leaf_splits, memory_order_relaxed);
+        stats->internal_splits = atomic_load_explicit(&pager->stats.internal_splits, memory_order_relaxed);
+        if (table->memtable != NULL) {
+            pthread_rwlock_rdlock(&table->memtable->latch);
+            stats->memtable_rows = table->memtable->count;
+            pthread_rwlock_unlock(&table->memtable->latch);
+        }
+
+        if (table->cow != NULL) {
+            // Walk the published version; the writer's working pages may be mid-update
+            uint64_t version;
+            const uint32_t slot = cow_pin(table->cow, &version);
+            measure_subtree(pager, (uint32_t) version, 1, CURSOR_LATCH_SNAPSHOT, stats);
+            atomic_store(&table->cow->readers[slot], 0);
+        } else {
+            pthread_rwlock_rdlock(&table->tree_latch);
+            if (table->hash) {
+                hash_measure(table, stats);
+            } else {
+                measure_subtree(pager, table->root_page_num, 1, CURSOR_LATCH_SHARED, stats);
+            }
+            pthread_rwlock_unlock(&table->tree_latch);
+        }
+        pthread_mutex_lock(&pager->lock);
+        stats->num_pages = pager->num_pages;
+        pthread_mutex_unlock(&pager->lock);
     }
 
-    const ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        printf("Error writing :%d\n", errno);
-        exit(EXIT_FAILURE);
+    if (stats->leaf_pages > 0) {
+        const uint32_t max_cells = table->hash ? HASH_BUCKET_MAX_CELLS : LEAF_NODE_MAX_CELLS;
+        stats->leaf_fill = (double) stats->rows / ((double) stats->leaf_pages * max_cells);
+    }
+}
+
+/*
+ * Internal nodes only change under the exclusive tree latch, which the caller keeps out by holding
+ * it shared, but inserts that don't split change leaves under their frame latch alone.
+ */
+void measure_subtree(Pager *pager, uint32_t page_num, uint32_t depth, CursorLatch latch, TableStats *stats) {
+    void *node = get_page(pager, page_num);
+    if (depth > stats->tree_height) {
+        stats->tree_height = depth;
+    }
+    if (get_node_type(node) == NODE_LEAF) {
+        stats->leaf_pages++;
+        pager_latch(pager, page_num, latch);
+        stats->rows += *leaf_node_num_cells(node);
+        pager_unlatch(pager, page_num, latch);
+        return;
     }
+    stats->internal_pages++;
+    const uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        measure_subtree(pager, *internal_node_child(node, i), depth + 1, latch, stats);
+    }
+    measure_subtree(pager, *internal_node_right_child(node), depth + 1, latch, stats);
 }
 
 void *cursor_value(Cursor *cursor) {
+    if (cursor->shard_cursors != NULL) {
+        return cursor_value(&cursor->shard_cursors[cursor->current_shard]);
+    }
+    if (cursor->merges_memtable && memtable_cursor_on_memtable(cursor)) {
+        return cursor->memtable_node->value;
+    }
+
     void *page = get_page(cursor->table->pager, cursor->page_num);
+    if (cursor->table->hash) {
+        return hash_bucket_value(page, cursor->cell_num);
+    }
     return leaf_node_value(page, cursor->cell_num);
 }
 
+uint32_t cursor_key(Cursor *cursor) {
+    if (cursor->shard_cursors != NULL) {
+        return cursor_key(&cursor->shard_cursors[cursor->current_shard]);
+    }
+    if (cursor->merges_memtable && memtable_cursor_on_memtable(cursor)) {
+        return cursor->memtable_node->key;
+    }
+
+    void *page = get_page(cursor->table->pager, cursor->page_num);
+    if (cursor->table->hash) {
+        return *hash_bucket_key(page, cursor->cell_num);
+    }
+    return *leaf_node_key(page, cursor->cell_num);
+}
+
 // cursor 位置前进 1 行
 void cursor_advance(Cursor *cursor) {
     assert(!cursor->end_of_table);
 
+    if (cursor->shard_cursors != NULL) {
+        shard_cursor_advance(cursor);
+        return;
+    }
+    if (cursor->merges_memtable) {
+        memtable_cursor_advance(cursor);
+        return;
+    }
+    if (cursor->table->hash) {
+        hash_cursor_advance(cursor);
+        return;
+    }
+
     uint32_t page_num = cursor->page_num;
     void *node = get_page(cursor->table->pager, page_num);
     cursor->cell_num += 1;
     if (cursor->cell_num >= *leaf_node_num_cells(node)) {
+        if (cursor->latch == CURSOR_LATCH_SNAPSHOT) {
+            /*
+             * Copying a leaf leaves its left neighbour's next pointer stale, so snapshot
+             * readers find the next leaf by searching for the key after this leaf's largest.
+             */
+            const uint32_t max_key = get_node_max_key(cursor->table->pager, node);
+            if (max_key == UINT32_MAX) {
+                cursor->end_of_table = true;
+                return;
+            }
+            Cursor next;
+            table_descend(cursor->table, cursor->root_page_num, max_key + 1, CURSOR_LATCH_SNAPSHOT, &next);
+            void *next_node = get_page(cursor->table->pager, next.page_num);
+            if (next.page_num == page_num || next.cell_num >= *leaf_node_num_cells(next_node)) {
+                cursor->end_of_table = true;
+            } else {
+                cursor->page_num = next.page_num;
+                cursor->cell_num = next.cell_num;
+            }
+            return;
+        }
+
         uint32_t next_page_num = *leaf_node_next_leaf(node);
         if (next_page_num == 0) {
             cursor->end_of_table = true;
         } else {
+            // Leaves are always latched left to right, so coupling them cannot deadlock
+            pager_latch(cursor->table->pager, next_page_num, cursor->latch);
+            pager_unlatch(cursor->table->pager, page_num, cursor->latch);
             cursor->page_num = next_page_num;
             cursor->cell_num = 0;
         }
     }
 }
 
+void cursor_retreat(Cursor *cursor) {
+    assert(!cursor->end_of_table);
+
+    if (cursor->shard_cursors != NULL) {
+        shard_cursor_retreat(cursor);
+        return;
+    }
+    if (cursor->merges_memtable) {
+        memtable_cursor_retreat(cursor);
+        return;
+    }
+    assert(!cursor->table->hash);
+
+    if (cursor->cell_num > 0) {
+        cursor->cell_num -= 1;
+        return;
+    }
+    Pager *pager = cursor->table->pager;
+    const uint32_t page_num = cursor->page_num;
+    void *node = get_page(pager, page_num);
+    if (cursor->latch == CURSOR_LATCH_SNAPSHOT) {
+        // Prev pointers go stale like next pointers, so search instead, as cursor_advance does
+        const uint32_t prev_page_num = snapshot_leaf_before(pager, cursor->root_page_num, *leaf_node_key(node, 0));
+        if (prev_page_num == INVALIDE_PAGE_NUM) {
+            cursor->end_of_table = true;
+        } else {
+            cursor->page_num = prev_page_num;
+            cursor->cell_num = *leaf_node_num_cells(get_page(pager, prev_page_num)) - 1;
+        }
+        return;
+    }
+
+    const uint32_t prev_page_num = *leaf_node_prev_leaf(node);
+    if (prev_page_num == 0) {
+        cursor->end_of_table = true;
+        return;
+    }
+    /*
+     * Coupling right to left could deadlock against cursors moving left to right, so the leaf is
+     * released first. The prev pointer stays valid: leaves only split under the exclusive tree
+     * latch, which this cursor keeps out.
+     */
+    pager_unlatch(pager, page_num, cursor->latch);
+    pager_latch(pager, prev_page_num, cursor->latch);
+    cursor->page_num = prev_page_num;
+    cursor->cell_num = *leaf_node_num_cells(get_page(pager, prev_page_num)) - 1;
+}
+
+// The right-most leaf holding keys below key, or INVALIDE_PAGE_NUM if key is in the first leaf
+uint32_t snapshot_leaf_before(Pager *pager, uint32_t root_page_num, uint32_t key) {
+    uint32_t left_page_num = INVALIDE_PAGE_NUM;
+    void *node = get_page(pager, root_page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        const uint32_t child_index = internal_node_find_child(node, key);
+        if (child_index > 0) {
+            // The closest left sibling subtree is the deepest one seen
+            left_page_num = *internal_node_child(node, child_index - 1);
+        }
+        node = get_page(pager, *internal_node_child(node, child_index));
+    }
+    if (left_page_num == INVALIDE_PAGE_NUM) {
+        return INVALIDE_PAGE_NUM;
+    }
+    node = get_page(pager, left_page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        left_page_num = *internal_node_right_child(node);
+        node = get_page(pager, left_page_num);
+    }
+    return left_page_num;
+}
+
 uint32_t *leaf_node_num_cells(void *node) {
     return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
@@ -346,13 +1234,75 @@ void set_node_type(void *node, NodeType type) {
 }
 
 
-void leaf_node_insert(const Cursor *cursor, uint32_t key, const Row *value) {
+bool table_can_insert(const Cursor *cursor, uint32_t key) {
+    if (cursor->table->hash) {
+        return hash_can_insert(cursor, key);
+    }
+
+    Table *table = cursor->table;
+    Pager *pager = table->pager;
+    const bool leaf_full = *leaf_node_num_cells(get_page(pager, cursor->page_num)) >= LEAF_NODE_MAX_CELLS;
+    if (!leaf_full && table->cow == NULL) {
+        return true;
+    }
+
+    // Walk down again to record the path; parent pointers can be stale in copy-on-write mode
+    uint32_t path[BTREE_MAX_HEIGHT];
+    uint32_t depth = 0;
+    path[depth++] = cursor->root_page_num;
+    void *node = get_page(pager, cursor->root_page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        path[depth] = *internal_node_child(node, internal_node_find_child(node, key));
+        node = get_page(pager, path[depth++]);
+    }
+
+    uint32_t pages_needed = 0;
+    if (leaf_full) {
+        // One page per node that splits, plus one more if the split reaches the root
+        pages_needed = 1;
+        for (uint32_t level = depth - 1;; level--) {
+            if (level == 0) {
+                pages_needed++;
+                break;
+            }
+            if (*internal_node_num_keys(get_page(pager, path[level - 1])) < INTERNAL_NODE_MAX_CELLS) {
+                break;
+            }
+            pages_needed++;
+        }
+    }
+
+    uint32_t pages_available = TABLE_MAX_PAGES - pager->num_pages;
+    if (table->cow != NULL) {
+        pages_needed += depth;
+        pages_available += table->cow->num_free;
+    }
+    return pages_needed <= pages_available;
+}
+
+void leaf_node_insert(const Cursor *cursor, uint32_t key, const void *value) {
+    if (cursor->table->hash) {
+        hash_insert(cursor, key, value);
+        return;
+    }
+    if (cursor->latch == CURSOR_LATCH_COW_WRITER) {
+        // Redirect the insert to a private copy of the leaf
+        Cursor copy = *cursor;
+        copy.page_num = cow_copy_path(cursor->table, key);
+        copy.latch = CURSOR_LATCH_TREE;
+        leaf_node_insert(&copy, key, value);
+        return;
+    }
+
     void *node = get_page(cursor->table->pager, cursor->page_num);
     const uint32_t num_cells = *leaf_node_num_cells(node);
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
 
     if (num_cells >= LEAF_NODE_MAX_CELLS) {
         // node full
+        const uint64_t start = profile_start();
         leaf_node_split_and_insert(cursor, key, value);
+        profile_record(PROFILE_SPLIT, start);
         return;
     }
 
@@ -364,7 +1314,7 @@ void leaf_node_insert(const Cursor *cursor, uint32_t key, const Row *value) {
     }
     *(leaf_node_num_cells(node)) += 1;
     *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    memcpy(leaf_node_value(node, cursor->cell_num), value, ROW_SIZE);
 }
 
 void leaf_node_split_and_insert(const Cursor *cursor, uint32_t key, const void *value) {
@@ -374,14 +1324,23 @@ void leaf_node_split_and_insert(const Cursor *cursor, uint32_t key, const void *
      * Update parent or create a new parent.
      */
 
+    pager_count(&cursor->table->pager->stats.leaf_splits, 1);
     void *old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = get_node_max_key(old_node);
-    const uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
+    uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
+    const uint32_t new_page_num = get_unused_page_num(cursor->table);
     void *new_node = get_page(cursor->table->pager, new_page_num);
+    pager_mark_dirty(cursor->table->pager, new_page_num);
     initialize_leaf_node(new_node);
     *node_parent(new_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+    const uint32_t next_page_num = *leaf_node_next_leaf(old_node);
+    *leaf_node_next_leaf(new_node) = next_page_num;
+    *leaf_node_prev_leaf(new_node) = cursor->page_num;
     *leaf_node_next_leaf(old_node) = new_page_num;
+    // A copy-on-write writer may not touch the published neighbour; cow_checkpoint relinks it
+    if (next_page_num != 0 && cursor->table->cow == NULL) {
+        *leaf_node_prev_leaf(get_page(cursor->table->pager, next_page_num)) = new_page_num;
+        pager_mark_dirty(cursor->table->pager, next_page_num);
+    }
 
     /*
      * All existing keys plus new key should be divided evenly between old (left) and new (right) nodes.
@@ -399,7 +1358,7 @@ void leaf_node_split_and_insert(const Cursor *cursor, uint32_t key, const void *
 
         if (i == (int32_t) cursor->cell_num) {
             *(uint32_t *) destination = key;
-            serialize_row(value, destination + LEAF_NODE_KEY_SIZE);
+            memcpy(destination + LEAF_NODE_KEY_SIZE, value, ROW_SIZE);
         } else if (i > (int32_t) cursor->cell_num) {
             memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
         } else {
@@ -415,16 +1374,24 @@ void leaf_node_split_and_insert(const Cursor *cursor, uint32_t key, const void *
         return create_new_root(cursor->table, new_page_num);
     } else {
         uint32_t parent_page_num = *node_parent(old_node);
-        uint32_t new_max = get_node_max_key(old_node);
+        uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
         void *parent = get_page(cursor->table->pager, parent_page_num);
+        pager_mark_dirty(cursor->table->pager, parent_page_num);
         update_internal_node_key(parent, old_max, new_max);
         internal_node_insert(cursor->table, parent_page_num, new_page_num);
         return;
     }
 }
 
-uint32_t get_unused_page_num(const Pager *pager) {
-    return pager->num_pages;
+uint32_t get_unused_page_num(const Table *table) {
+    CowState *cow = table->cow;
+    if (cow == NULL) {
+        return table->pager->num_pages;
+    }
+
+    const uint32_t page_num = cow->num_free > 0 ? cow->free_pages[--cow->num_free] : table->pager->num_pages;
+    cow->fresh_txn[page_num] = cow->txn;
+    return page_num;
 }
 
 bool is_node_root(void *node) {
@@ -445,19 +1412,34 @@ void create_new_root(Table *table, uint32_t right_child_page_num) {
      */
     void *root = get_page(table->pager, table->root_page_num);
     void *right_child = get_page(table->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_page_num(table->pager);
+    uint32_t left_child_page_num = get_unused_page_num(table);
     void *left_child = get_page(table->pager, left_child_page_num);
+    pager_mark_dirty(table->pager, table->root_page_num);
+    pager_mark_dirty(table->pager, right_child_page_num);
+    pager_mark_dirty(table->pager, left_child_page_num);
+
+    if (get_node_type(root) == NODE_INTERNAL) {
+        initialize_internal_node(right_child);
+    }
 
     // Left child has data copied from old root
     memcpy(left_child, root, PAGE_SIZE);
     set_node_root(left_child, false);
+    if (get_node_type(left_child) == NODE_LEAF) {
+        // The split linked the right leaf back to the root page
+        *leaf_node_prev_leaf(right_child) = left_child_page_num;
+    } else {
+        for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+            set_node_parent(table, *internal_node_child(left_child, i), left_child_page_num);
+        }
+    }
 
     // Root node is a new internal node with one key and two children
     initialize_internal_node(root);
     set_node_root(root, true);
     *internal_node_num_keys(root) = 1;
     *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(left_child);
+    uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
     *internal_node_key(root, 0) = left_child_max_key;
     *internal_node_right_child(root) = right_child_page_num;
     *node_parent(left_child) = table->root_page_num;
@@ -469,6 +1451,7 @@ void initialize_leaf_node(void *node) {
     set_node_root(node, false);
     *leaf_node_num_cells(node) = 0;
     *leaf_node_next_leaf(node) = 0;
+    *leaf_node_prev_leaf(node) = 0;
 }
 
 void initialize_internal_node(void *node) {
@@ -483,11 +1466,7 @@ uint32_t *internal_node_num_keys(void *node) {
 }
 
 uint32_t *internal_node_right_child(void *node) {
-    uint32_t *right_child = (uint32_t *) (node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
-    if (*right_child == INVALIDE_PAGE_NUM) {
-        printf("Tried to access right child of node, but was invalid page\n");
-    }
-    return right_child;
+    return (uint32_t *) (node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
 }
 
 void *internal_node_cell(void *node, uint32_t cell_num) {
@@ -495,29 +1474,24 @@ void *internal_node_cell(void *node, uint32_t cell_num) {
 }
 
 uint32_t *internal_node_child(void *node, uint32_t child_num) {
-    uint32_t num_keys = *internal_node_num_keys(node);
-    if (child_num > num_keys) {
-        printf("Tried to access child_num %d > num_keys %d\n", child_num, num_keys);
-        exit(EXIT_FAILURE);
-    } else if (child_num == num_keys) {
+    // Callers index within num_keys; an INVALIDE_PAGE_NUM child is caught by get_page
+    const uint32_t num_keys = *internal_node_num_keys(node);
+    assert(child_num <= num_keys);
+    if (child_num == num_keys) {
         return internal_node_right_child(node);
-    } else {
-        uint32_t *child = (uint32_t *) (internal_node_cell(node, child_num) + INTERNAL_NODE_KEY_SIZE);
-        if (*child == INVALIDE_PAGE_NUM) {
-            printf("Tried to access child %d of node, but was invalid page\n", child_num);
-        }
-        return child;
     }
+    return (uint32_t *) (internal_node_cell(node, child_num) + INTERNAL_NODE_KEY_SIZE);
 }
 
 uint32_t *internal_node_key(void *node, uint32_t key_num) {
     return internal_node_cell(node, key_num);
 }
 
-uint32_t get_node_max_key(void *node) {
+uint32_t get_node_max_key(Pager *pager, void *node) {
     switch (get_node_type(node)) {
         case NODE_INTERNAL:
-            return *internal_node_key(node, *internal_node_num_keys(node) - 1);
+            // The largest key lives in the right-most subtree, not in this node's keys
+            return get_node_max_key(pager, get_page(pager, *internal_node_right_child(node)));
         case NODE_LEAF:
             return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
     }
@@ -527,10 +1501,31 @@ uint32_t *leaf_node_next_leaf(void *node) {
     return node + LEAF_NODE_NEXT_LEAF_OFFSET;
 }
 
+// 0 for the first leaf: page 0 only holds a leaf while it is the whole tree
+uint32_t *leaf_node_prev_leaf(void *node) {
+    return node + LEAF_NODE_PREV_LEAF_OFFSET;
+}
+
+uint32_t *root_node_format(void *root) {
+    return node_parent(root);
+}
+
 uint32_t *node_parent(void *node) {
     return (uint32_t *) (node + PARENT_POINTER_OFFSET);
 }
 
+/*
+ * In copy-on-write mode a transaction may only write the pages it owns. Parent pointers of the
+ * other pages are not read before cow_copy_path or cow_checkpoint rewrites them, so they are skipped.
+ */
+void set_node_parent(const Table *table, uint32_t page_num, uint32_t parent_page_num) {
+    if (table->cow != NULL && table->cow->fresh_txn[page_num] != table->cow->txn) {
+        return;
+    }
+    *node_parent(get_page(table->pager, page_num)) = parent_page_num;
+    pager_mark_dirty(table->pager, page_num);
+}
+
 void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key) {
     uint32_t old_child_index = internal_node_find_child(node, old_key);
     *internal_node_key(node, old_child_index) = new_key;
@@ -560,11 +1555,11 @@ void internal_node_insert(const Table *table, uint32_t parent_page_num, uint32_t
     // Add a new child/key pair to parent that corresponds to child
     void *parent = get_page(table->pager, parent_page_num);
     void *child = get_page(table->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(child);
+    uint32_t child_max_key = get_node_max_key(table->pager, child);
+    pager_mark_dirty(table->pager, parent_page_num);
     uint32_t index = internal_node_find_child(parent, child_max_key);
 
     uint32_t original_num_keys = *internal_node_num_keys(parent);
-    *internal_node_num_keys(parent) = original_num_keys + 1;
 
     if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
         internal_node_split_and_insert(table, parent_page_num, child_page_num);
@@ -584,7 +1579,7 @@ void internal_node_insert(const Table *table, uint32_t parent_page_num, uint32_t
     // internal_node_split_and_insert has the effect of creating a new key \
     // at (max_cells + 1) with an uninitialized value
     *internal_node_num_keys(parent) = original_num_keys + 1;
-    uint32_t right_child_max_key = get_node_max_key(right_child);
+    uint32_t right_child_max_key = get_node_max_key(table->pager, right_child);
 
     if (child_max_key > right_child_max_key) {
         // Replace right child
@@ -604,5 +1599,65 @@ void internal_node_insert(const Table *table, uint32_t parent_page_num, uint32_t
 }
 
 void internal_node_split_and_insert(const Table *table, uint32_t parent_page_num, uint32_t child_page_num) {
-    // todo
+    /*
+     * Move the upper half of the full node's children into a new node, insert the child into
+     * whichever half it belongs to, then fix the parent's key and add the new node to it.
+     */
+    Pager *pager = table->pager;
+    pager_count(&pager->stats.internal_splits, 1);
+    uint32_t old_page_num = parent_page_num;
+    void *old_node = get_page(pager, old_page_num);
+    const uint32_t old_max = get_node_max_key(pager, old_node);
+
+    void *child = get_page(pager, child_page_num);
+    const uint32_t child_max = get_node_max_key(pager, child);
+
+    const uint32_t new_page_num = get_unused_page_num(table);
+    const bool splitting_root = is_node_root(old_node);
+
+    void *parent;
+    if (splitting_root) {
+        // The old root's contents move to a new left child; split that instead
+        create_new_root((Table *) table, new_page_num);
+        parent = get_page(pager, table->root_page_num);
+        old_page_num = *internal_node_child(parent, 0);
+        old_node = get_page(pager, old_page_num);
+    } else {
+        parent = get_page(pager, *node_parent(old_node));
+        initialize_internal_node(get_page(pager, new_page_num));
+    }
+    pager_mark_dirty(pager, old_page_num);
+    pager_mark_dirty(pager, new_page_num);
+    pager_mark_dirty(pager, *node_parent(old_node));
+
+    uint32_t *old_num_keys = internal_node_num_keys(old_node);
+
+    uint32_t moved_page_num = *internal_node_right_child(old_node);
+    internal_node_insert(table, new_page_num, moved_page_num);
+    set_node_parent(table, moved_page_num, new_page_num);
+    *internal_node_right_child(old_node) = INVALIDE_PAGE_NUM;
+
+    for (int32_t i = (int32_t) INTERNAL_NODE_MAX_CELLS - 1; i > (int32_t) INTERNAL_NODE_MAX_CELLS / 2; i--) {
+        moved_page_num = *internal_node_child(old_node, i);
+        internal_node_insert(table, new_page_num, moved_page_num);
+        set_node_parent(table, moved_page_num, new_page_num);
+        (*old_num_keys)--;
+    }
+
+    // The last remaining key's child becomes the old node's right child
+    *internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys - 1);
+    (*old_num_keys)--;
+
+    const uint32_t max_after_split = get_node_max_key(pager, old_node);
+    const uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
+    internal_node_insert(table, destination_page_num, child_page_num);
+    set_node_parent(table, child_page_num, destination_page_num);
+
+    update_internal_node_key(parent, old_max, get_node_max_key(pager, old_node));
+
+    if (!splitting_root) {
+        // Set before inserting: if the grandparent splits too, it re-parents the new node itself
+        *node_parent(get_page(pager, new_page_num)) = *node_parent(old_node);
+        internal_node_insert(table, *node_parent(old_node), new_page_num);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,292 @@
+#include "../inc/vacuum.h"
+#include "../inc/shard.h"
+#include "../inc/flusher.h"
+#include "../inc/memtable.h"
+#include <libgen.h>
+
+typedef struct {
+    uint32_t page_num;
+    uint32_t max_key;
+} VacuumNode;
+
+typedef struct {
+    Pager *target;
+    uint64_t num_rows;
+    uint32_t num_leaves;
+    uint32_t leaf;     // Leaf being filled
+    uint32_t num_cells;// Cells copied into it so far
+    void *leaf_node;
+    VacuumNode *leaves;
+} VacuumBuilder;
+
+uint64_t vacuum_count_rows(Pager *pager, uint32_t page_num);
+
+void vacuum_copy_rows(VacuumBuilder *builder, Pager *source, uint32_t page_num);
+
+void vacuum_finish_leaf(VacuumBuilder *builder);
+
+uint32_t vacuum_leaf_page(const VacuumBuilder *builder, uint32_t leaf);
+
+void *vacuum_new_page(Pager *pager, uint32_t page_num);
+
+uint32_t vacuum_num_pages(uint32_t num_leaves);
+
+VacuumResult vacuum_build(Table *table, const char *path, uint32_t fill_percent);
+
+bool vacuum_swap(Table *table, const char *path);
+
+bool vacuum_sync_dir(const char *path);
+
+VacuumResult table_vacuum(Table *table, uint32_t fill_percent) {
+    if (table->shards != NULL) {
+        VacuumResult result = VACUUM_SUCCESS;
+        for (uint32_t i = 0; i < table->shards->num_shards; i++) {
+            const VacuumResult shard_result = table_vacuum(table->shards->tables[i], fill_percent);
+            if (result == VACUUM_SUCCESS) {
+                result = shard_result;
+            }
+        }
+        return result;
+    }
+
+    if (table->hash) {
+        return VACUUM_HASH_TABLE;
+    }
+    if (table->memtable != NULL) {
+        // Buffered rows are packed along with the rest
+        pthread_rwlock_wrlock(&table->memtable->latch);
+        const bool merged = memtable_merge(table);
+        pthread_rwlock_unlock(&table->memtable->latch);
+        if (!merged) {
+            return VACUUM_TOO_LARGE;
+        }
+    }
+
+    // The flusher writes through the pager that is about to be replaced
+    flusher_stop(table);
+    CowState *cow = table->cow;
+    if (cow != NULL) {
+        // Readers take no latch, so new pins are held off until the swap is done
+        pthread_mutex_lock(&cow->writer_lock);
+        atomic_store(&cow->vacuuming, true);
+        for (uint32_t i = 0; i < COW_MAX_READERS; i++) {
+            if (atomic_load(&cow->readers[i]) != 0) {
+                atomic_store(&cow->vacuuming, false);
+                pthread_mutex_unlock(&cow->writer_lock);
+                flusher_start(table);
+                return VACUUM_SNAPSHOT_OPEN;
+            }
+        }
+    }
+    pthread_rwlock_wrlock(&table->tree_latch);
+
+    const size_t path_size = strlen(table->pager->filename) + sizeof(".vacuum");
+    char *path = malloc(path_size);
+    snprintf(path, path_size, "%s.vacuum", table->pager->filename);
+    VacuumResult result = vacuum_build(table, path, fill_percent);
+    if (result == VACUUM_SUCCESS && !vacuum_swap(table, path)) {
+        result = VACUUM_IO_ERROR;
+    }
+    if (result != VACUUM_SUCCESS) {
+        unlink(path);
+    }
+    free(path);
+
+    pthread_rwlock_unlock(&table->tree_latch);
+    if (cow != NULL) {
+        atomic_store(&cow->vacuuming, false);
+        pthread_mutex_unlock(&cow->writer_lock);
+    }
+    flusher_start(table);
+    return result;
+}
+
+uint64_t vacuum_count_rows(Pager *pager, uint32_t page_num) {
+    void *node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node);
+    }
+    uint64_t rows = vacuum_count_rows(pager, *internal_node_right_child(node));
+    for (uint32_t i = 0; i < *internal_node_num_keys(node); i++) {
+        rows += vacuum_count_rows(pager, *internal_node_child(node, i));
+    }
+    return rows;
+}
+
+// Walks the tree rather than the leaf chain, which copy-on-write mode only relinks at db_close
+void vacuum_copy_rows(VacuumBuilder *builder, Pager *source, uint32_t page_num) {
+    void *node = get_page(source, page_num);
+    if (get_node_type(node) == NODE_INTERNAL) {
+        for (uint32_t i = 0; i < *internal_node_num_keys(node); i++) {
+            vacuum_copy_rows(builder, source, *internal_node_child(node, i));
+        }
+        vacuum_copy_rows(builder, source, *internal_node_right_child(node));
+        return;
+    }
+
+    const uint32_t num_cells = *leaf_node_num_cells(node);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        // Spread the rows evenly, so the last leaf isn't left nearly empty
+        const uint32_t leaf_cells = builder->num_rows / builder->num_leaves +
+                                    (builder->leaf < builder->num_rows % builder->num_leaves);
+        if (builder->num_cells == leaf_cells) {
+            vacuum_finish_leaf(builder);
+            builder->leaf++;
+            builder->num_cells = 0;
+            builder->leaf_node = vacuum_new_page(builder->target, vacuum_leaf_page(builder, builder->leaf));
+            initialize_leaf_node(builder->leaf_node);
+        }
+        memcpy(leaf_node_cell(builder->leaf_node, builder->num_cells), leaf_node_cell(node, i),
+               LEAF_NODE_CELL_SIZE);
+        builder->num_cells++;
+    }
+}
+
+void vacuum_finish_leaf(VacuumBuilder *builder) {
+    void *node = builder->leaf_node;
+    const uint32_t leaf = builder->leaf;
+    *leaf_node_num_cells(node) = builder->num_cells;
+    *leaf_node_next_leaf(node) = leaf + 1 < builder->num_leaves ? vacuum_leaf_page(builder, leaf + 1) : 0;
+    *leaf_node_prev_leaf(node) = leaf > 0 ? vacuum_leaf_page(builder, leaf - 1) : 0;
+    builder->leaves[leaf].page_num = vacuum_leaf_page(builder, leaf);
+    builder->leaves[leaf].max_key = builder->num_cells > 0 ? *leaf_node_key(node, builder->num_cells - 1) : 0;
+}
+
+// A lone leaf is the root and lives on page 0; otherwise the leaves follow the root
+uint32_t vacuum_leaf_page(const VacuumBuilder *builder, uint32_t leaf) {
+    return builder->num_leaves == 1 ? 0 : leaf + 1;
+}
+
+// Zeroed, so the file never holds whatever the frame's allocation happened to contain
+void *vacuum_new_page(Pager *pager, uint32_t page_num) {
+    void *node = get_page(pager, page_num);
+    memset(node, 0, PAGE_SIZE);
+    return node;
+}
+
+uint32_t vacuum_num_pages(uint32_t num_leaves) {
+    const uint32_t fan_out = INTERNAL_NODE_MAX_CELLS + 1;
+    uint32_t num_pages = num_leaves == 1 ? 1 : num_leaves + 1;
+    for (uint32_t count = num_leaves; count > 1;) {
+        count = (count + fan_out - 1) / fan_out;
+        if (count > 1) {
+            num_pages += count;
+        }
+    }
+    return num_pages;
+}
+
+VacuumResult vacuum_build(Table *table, const char *path, uint32_t fill_percent) {
+    uint32_t cells_per_leaf = LEAF_NODE_MAX_CELLS * fill_percent / 100;
+    if (cells_per_leaf == 0) {
+        cells_per_leaf = 1;
+    }
+    VacuumBuilder builder = {.num_rows = vacuum_count_rows(table->pager, table->root_page_num)};
+    builder.num_leaves = builder.num_rows <= cells_per_leaf
+                                 ? 1
+                                 : (uint32_t) ((builder.num_rows + cells_per_leaf - 1) / cells_per_leaf);
+    if (vacuum_num_pages(builder.num_leaves) > TABLE_MAX_PAGES) {
+        return VACUUM_TOO_LARGE;
+    }
+
+    unlink(path);
+    builder.target = pager_open(path, table->pager->io->kind);
+    if (builder.target == NULL) {
+        return VACUUM_IO_ERROR;
+    }
+    Pager *target = builder.target;
+    // Page 0 first: get_page only grows num_pages, and the root is written last
+    vacuum_new_page(target, 0);
+    builder.leaves = malloc(sizeof(VacuumNode) * builder.num_leaves);
+    builder.leaf_node = vacuum_new_page(target, vacuum_leaf_page(&builder, 0));
+    initialize_leaf_node(builder.leaf_node);
+    vacuum_copy_rows(&builder, table->pager, table->root_page_num);
+    vacuum_finish_leaf(&builder);
+
+    // Build the internal levels bottom up, splitting each level's nodes evenly between parents
+    const uint32_t fan_out = INTERNAL_NODE_MAX_CELLS + 1;
+    uint32_t next_page_num = builder.num_leaves + 1;
+    VacuumNode *level = builder.leaves;
+    uint32_t count = builder.num_leaves;
+    while (count > 1) {
+        const uint32_t num_parents = (count + fan_out - 1) / fan_out;
+        VacuumNode *parents = malloc(sizeof(VacuumNode) * num_parents);
+        uint32_t child = 0;
+        for (uint32_t i = 0; i < num_parents; i++) {
+            const uint32_t num_children = count / num_parents + (i < count % num_parents);
+            parents[i].page_num = num_parents == 1 ? 0 : next_page_num++;
+            void *node = vacuum_new_page(target, parents[i].page_num);
+            initialize_internal_node(node);
+            *internal_node_num_keys(node) = num_children - 1;
+            for (uint32_t j = 0; j < num_children; j++, child++) {
+                if (j + 1 < num_children) {
+                    *internal_node_child(node, j) = level[child].page_num;
+                    *internal_node_key(node, j) = level[child].max_key;
+                } else {
+                    *internal_node_right_child(node) = level[child].page_num;
+                }
+                *node_parent(get_page(target, level[child].page_num)) = parents[i].page_num;
+            }
+            parents[i].max_key = level[child - 1].max_key;
+        }
+        free(level);
+        level = parents;
+        count = num_parents;
+    }
+    free(level);
+    set_node_root(get_page(target, 0), true);
+    *root_node_format(get_page(target, 0)) = BTREE_FORMAT_MAGIC;
+
+    // Every page is new to the file, so all of them are dirty
+    bool success = pager_flush_dirty(target);
+    success &= fsync(target->file_descriptor) == 0;
+    // A source page that could not be read left rows out of the new file
+    success &= table_io_error(table) == 0;
+    return pager_close(target, false) && success ? VACUUM_SUCCESS : VACUUM_IO_ERROR;
+}
+
+/*
+ * rename() replaces the file atomically: a crash leaves either the old tree or the new one.
+ * The old frames are dropped unflushed, since every row they hold is already in the new file.
+ */
+bool vacuum_swap(Table *table, const char *path) {
+    Pager *old_pager = table->pager;
+    if (rename(path, old_pager->filename) == -1) {
+        return false;
+    }
+    vacuum_sync_dir(old_pager->filename);
+
+    Pager *pager = pager_open(old_pager->filename, old_pager->io->kind);
+    if (pager == NULL) {
+        // The old frames still hold every row, but they now belong to an unlinked file
+        pager_fail(old_pager, errno != 0 ? errno : EIO);
+        return false;
+    }
+    memcpy(&pager->stats, &old_pager->stats, sizeof(PagerStats));
+    pager_close(old_pager, false);
+    table->pager = pager;
+    table->root_page_num = 0;
+
+    CowState *cow = table->cow;
+    if (cow != NULL) {
+        // Same txn, new root; the superseded pages went away with the old file
+        const uint64_t published_txn = atomic_load(&cow->version) >> 32;
+        memset(cow->fresh_txn, 0, sizeof(cow->fresh_txn));
+        cow->num_retired = 0;
+        cow->num_free = 0;
+        atomic_store(&cow->version, published_txn << 32);
+    }
+    return true;
+}
+
+bool vacuum_sync_dir(const char *path) {
+    char *path_copy = strdup(path);
+    const int fd = open(dirname(path_copy), O_RDONLY);
+    free(path_copy);
+    if (fd == -1) {
+        return false;
+    }
+    const bool success = fsync(fd) == 0;
+    close(fd);
+    return success;
+}
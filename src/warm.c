@@ -0,0 +1,186 @@
+#include "../inc/warm.h"
+
+const char WARM_SET_MAGIC[8] = {'S', 'D', 'B', 'W', 'A', 'R', 'M', '1'};
+#define WARM_SET_HEADER_SIZE (sizeof(WARM_SET_MAGIC) + sizeof(uint32_t))
+
+char *warm_set_path(const char *filename);
+
+uint32_t warm_set_pick(const Pager *pager, bool btree, uint32_t *page_nums);
+
+int warm_set_compare_touched(const void *a, const void *b);
+
+int warm_set_compare_page_nums(const void *a, const void *b);
+
+uint32_t *warm_set_read(const char *path, uint32_t *count);
+
+void warm_set_read_runs(Pager *pager, const uint32_t *page_nums, uint32_t count);
+
+char *warm_set_path(const char *filename) {
+    const size_t path_size = strlen(filename) + sizeof(WARM_SET_SUFFIX);
+    char *path = malloc(path_size);
+    snprintf(path, path_size, "%s%s", filename, WARM_SET_SUFFIX);
+    return path;
+}
+
+bool warm_set_save(const Pager *pager, bool btree) {
+    uint32_t *page_nums = malloc(sizeof(uint32_t) * (pager->num_pages + 1));
+    const uint32_t count = warm_set_pick(pager, btree, page_nums);
+
+    char *path = warm_set_path(pager->filename);
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    free(path);
+    if (fd == -1) {
+        free(page_nums);
+        return false;
+    }
+    char header[WARM_SET_HEADER_SIZE];
+    memcpy(header, WARM_SET_MAGIC, sizeof(WARM_SET_MAGIC));
+    memcpy(header + sizeof(WARM_SET_MAGIC), &count, sizeof(uint32_t));
+    const struct iovec iov[] = {
+            {.iov_base = header, .iov_len = WARM_SET_HEADER_SIZE},
+            {.iov_base = page_nums, .iov_len = sizeof(uint32_t) * count},
+    };
+    const ssize_t expected = (ssize_t) (WARM_SET_HEADER_SIZE + sizeof(uint32_t) * count);
+    const bool success = writev(fd, iov, 2) == expected;
+    close(fd);
+    free(page_nums);
+    return success;
+}
+
+typedef struct {
+    uint32_t page_num;
+    uint32_t touched;
+} WarmSetCandidate;
+
+// Fills page_nums, ascending, with at most WARM_SET_MAX_PAGES resident pages and returns how many
+uint32_t warm_set_pick(const Pager *pager, bool btree, uint32_t *page_nums) {
+    uint32_t count = 0;
+    uint32_t num_candidates = 0;
+    WarmSetCandidate *candidates = malloc(sizeof(WarmSetCandidate) * (pager->num_pages + 1));
+    for (uint32_t i = 0; i < pager->num_pages; i++) {
+        if (pager->pages[i] == NULL) {
+            continue;
+        }
+        // Every descent goes through the internal nodes, and there are few of them
+        if (btree && get_node_type(pager->pages[i]) == NODE_INTERNAL && count < WARM_SET_MAX_PAGES) {
+            page_nums[count++] = i;
+        } else {
+            candidates[num_candidates++] = (WarmSetCandidate) {.page_num = i, .touched = pager->touched[i]};
+        }
+    }
+    if (count + num_candidates > WARM_SET_MAX_PAGES) {
+        qsort(candidates, num_candidates, sizeof(WarmSetCandidate), warm_set_compare_touched);
+        num_candidates = WARM_SET_MAX_PAGES - count;
+    }
+    for (uint32_t i = 0; i < num_candidates; i++) {
+        page_nums[count++] = candidates[i].page_num;
+    }
+    free(candidates);
+    qsort(page_nums, count, sizeof(uint32_t), warm_set_compare_page_nums);
+    return count;
+}
+
+// Most recently touched first; within one flusher pass, later pages first, as appends allocate them last
+int warm_set_compare_touched(const void *a, const void *b) {
+    const WarmSetCandidate *x = a;
+    const WarmSetCandidate *y = b;
+    if (x->touched != y->touched) {
+        return x->touched > y->touched ? -1 : 1;
+    }
+    return (x->page_num < y->page_num) - (x->page_num > y->page_num);
+}
+
+int warm_set_compare_page_nums(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+void warm_set_load(Pager *pager) {
+    if (pager->num_pages == 0) {
+        return;
+    }
+    char *path = warm_set_path(pager->filename);
+    uint32_t count;
+    uint32_t *page_nums = warm_set_read(path, &count);
+    free(path);
+    if (page_nums == NULL) {
+        return;
+    }
+
+    // Keep only pages the file still has, in ascending order, then read each run of neighbours at once
+    const uint64_t file_pages = pager->file_length / PAGE_SIZE;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (page_nums[i] < file_pages && page_nums[i] < TABLE_MAX_PAGES &&
+            (kept == 0 || page_nums[i] > page_nums[kept - 1]) && kept < WARM_SET_MAX_PAGES) {
+            page_nums[kept++] = page_nums[i];
+        }
+    }
+    warm_set_read_runs(pager, page_nums, kept);
+    free(page_nums);
+}
+
+// Returns NULL unless the whole sidecar is there
+uint32_t *warm_set_read(const char *path, uint32_t *count) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    char header[WARM_SET_HEADER_SIZE];
+    uint32_t *page_nums = NULL;
+    struct stat st;
+    if (read(fd, header, WARM_SET_HEADER_SIZE) == (ssize_t) WARM_SET_HEADER_SIZE &&
+        memcmp(header, WARM_SET_MAGIC, sizeof(WARM_SET_MAGIC)) == 0 && fstat(fd, &st) == 0) {
+        memcpy(count, header + sizeof(WARM_SET_MAGIC), sizeof(uint32_t));
+        const size_t size = sizeof(uint32_t) * (size_t) *count;
+        if (*count <= TABLE_MAX_PAGES && (size_t) st.st_size == WARM_SET_HEADER_SIZE + size) {
+            page_nums = malloc(size + sizeof(uint32_t));
+            if (read(fd, page_nums, size) != (ssize_t) size) {
+                free(page_nums);
+                page_nums = NULL;
+            }
+        }
+    }
+    close(fd);
+    return page_nums;
+}
+
+// Reads the pages, ascending, as one batch with a request per run of neighbours
+void warm_set_read_runs(Pager *pager, const uint32_t *page_nums, uint32_t count) {
+    struct iovec *iov = malloc(sizeof(struct iovec) * (count + 1));
+    IoRequest *requests = malloc(sizeof(IoRequest) * (count + 1));
+    uint32_t num_requests = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        iov[i] = (struct iovec) {.iov_base = malloc(PAGE_SIZE), .iov_len = PAGE_SIZE};
+        IoRequest *last = num_requests > 0 ? &requests[num_requests - 1] : NULL;
+        if (last != NULL && page_nums[i - 1] + 1 == page_nums[i] && last->iovcnt < WARM_SET_RUN_PAGES) {
+            last->iovcnt++;
+        } else {
+            requests[num_requests++] =
+                    (IoRequest) {.iov = &iov[i], .iovcnt = 1, .offset = (uint64_t) page_nums[i] * PAGE_SIZE};
+        }
+    }
+
+    io_submit(pager->io, IO_READ, requests, num_requests);
+    const uint32_t *page_num = page_nums;
+    for (uint32_t i = 0; i < num_requests; i++) {
+        const IoRequest *request = &requests[i];
+        const bool success = request->result == (int64_t) request->iovcnt * PAGE_SIZE;
+        for (uint32_t j = 0; j < request->iovcnt; j++) {
+            if (success && pager->pages[page_num[j]] == NULL) {
+                pager->pages[page_num[j]] = request->iov[j].iov_base;
+            } else {
+                // Left for get_page to read on demand, or already resident and possibly newer than the file
+                free(request->iov[j].iov_base);
+            }
+        }
+        if (success) {
+            pager_count(&pager->stats.pages_read, request->iovcnt);
+            pager_count(&pager->stats.bytes_read, request->result);
+        }
+        page_num += request->iovcnt;
+    }
+    free(requests);
+    free(iov);
+}